@@ -15,8 +15,10 @@ const attack_data_t* board_attack_data = board_attack_data_storage + 128;
 piece_flag_t near_attack_data_storage[256];
 const piece_flag_t* near_attack_data = near_attack_data_storage + 128;
 // For each piece and (from, to) pair, which squares need to be checked to
-// determine if the piece is almost attacking the |to| square?
-square_t near_attack_deltas[16][256][4];
+// determine if the piece is almost attacking the |to| square? Each list
+// ends with INVALID_DELTA. A queen can need eight deltas.
+#define MAX_NEAR_DELTAS     9
+square_t near_attack_deltas[16][256][MAX_NEAR_DELTAS];
 
 #define near_attack(from, to, piece) \
     ((near_attack_data[(from)-(to)] & piece_flags[(piece)]) != 0)
@@ -31,14 +33,13 @@ static void add_near_attack(square_t target,
         piece_t piece)
 {
     near_attack_data_storage[128+from-target] |= get_piece_flag(piece);
+    square_t* deltas = near_attack_deltas[piece][128+from-target];
     int i = 0;
-    for (; near_attack_deltas[piece][128+from-target][i] != INVALID_DELTA;
-            ++i) {
-        if (near_attack_deltas[piece][128+from-target][i] == delta) return;
+    for (; deltas[i] != INVALID_DELTA; ++i) {
+        if (deltas[i] == delta) return;
     }
-    assert(near_attack_deltas[piece][128+from-target][i] == INVALID_DELTA);
-    if (i<3) near_attack_deltas[piece][128+from-target][i] = delta;
-    assert(near_attack_deltas[piece][128+from-target][0] != INVALID_DELTA);
+    assert(i < MAX_NEAR_DELTAS-1);
+    deltas[i] = delta;
 }
 
 /*
@@ -77,7 +78,7 @@ void generate_attack_data(void)
     memset((char*)near_attack_data_storage, 0, sizeof(piece_flag_t)*256);
     for (int i=0; i<16; ++i)
         for (int j=0; j<256; ++j)
-            for (int k=0; k<4; ++k)
+            for (int k=0; k<MAX_NEAR_DELTAS; ++k)
                 near_attack_deltas[i][j][k] = INVALID_DELTA;
     for (square_t target=A1; target<=H8; ++target) {
         if (!valid_board_index(target)) continue;
@@ -124,6 +125,34 @@ direction_t pin_direction(const position_t* pos,
     return pin_dir;
 }
 
+/*
+ * Find all the pieces of the side to move that are pinned to their king.
+ * This walks each line out from the king once, so it's cheaper than calling
+ * pin_direction for every piece that moves.
+ */
+void find_pins(const position_t* pos, pin_info_t* pins)
+{
+    color_t side = pos->side_to_move;
+    square_t king_sq = pos->pieces[side][0];
+    pins->num_pinned = 0;
+    for (const direction_t* delta = piece_deltas[WQ]; *delta; ++delta) {
+        square_t sq;
+        for (sq = king_sq + *delta; pos->board[sq] == EMPTY; sq += *delta) {}
+        if (!piece_is_color(pos->board[sq], side)) continue;
+        // The first piece along this line is ours. Is there anything
+        // behind it that's doing the pinning?
+        square_t pinned_sq = sq;
+        for (sq += *delta; pos->board[sq] == EMPTY; sq += *delta) {}
+        piece_t pinner = pos->board[sq];
+        if (can_capture(pos->board[pinned_sq], pinner) &&
+                piece_slide_type(pinner) != NO_SLIDE &&
+                possible_attack(sq, king_sq, pinner)) {
+            pins->pinned[pins->num_pinned] = pinned_sq;
+            pins->pin_dir[pins->num_pinned++] = -*delta;
+        }
+    }
+}
+
 /*
  * Is |sq| being directly attacked by any pieces on |side|? Works on both
  * occupied and unoccupied squares.
@@ -161,12 +190,12 @@ bool piece_attacks_near(const position_t* pos, square_t from, square_t target)
 {
     piece_t p = pos->board[from];
     if (near_attack(from, target, p)) {
-        if (piece_slide_type(p) == NO_SLIDE) return true;
         int delta;
         for (int i=0; (delta = near_attack_deltas[p][128+from-target][i]) !=
                 INVALID_DELTA; ++i) {
             square_t sq = from + delta;
             if (pos->board[sq] == OUT_OF_BOUNDS) continue;
+            if (piece_slide_type(p) == NO_SLIDE) return true;
             direction_t att_dir = direction(from, sq);
             square_t x = from;
             while (x != sq) {
@@ -18,6 +18,13 @@ typedef struct {
     direction_t relative_direction;
 } attack_data_t;
 
+// Pieces pinned to their king, and the direction from each one to the king.
+typedef struct {
+    int num_pinned;
+    square_t pinned[8];
+    direction_t pin_dir[8];
+} pin_info_t;
+
 extern const attack_data_t* board_attack_data;
 extern const int* distance_data;
 
@@ -23,14 +23,13 @@ const char* positions[] = {
 };
 
 /*
- * Search all of the benchmark positions either to the given depth or for the
- * given amount of time. The positions come directly from Glaurung's benchmark
- * suite.
+ * Search each of the benchmark positions either to the given depth or for
+ * the given amount of time, and return the total time taken. The total
+ * number of nodes searched is added to |total_nodes|.
  */
-void benchmark(int depth, int time_limit)
+static int search_positions(int depth, int time_limit, uint64_t* total_nodes)
 {
     milli_timer_t bench_timer;
-    uint64_t total_nodes = 0;
     int time = 0;
     init_timer(&bench_timer);
     for (int i=0; ; ++i) {
@@ -44,12 +43,168 @@ void benchmark(int depth, int time_limit)
         root_data.depth_limit = depth*PLY;
         deepening_search(&root_data, false);
         time = stop_timer(&bench_timer);
+        uint64_t nodes = total_nodes_searched(&root_data);
         printf("time: %d\ndepth: %d\nnodes: %"PRIu64"\n",
-                time, (int)root_data.current_depth, root_data.nodes_searched);
-        total_nodes += root_data.nodes_searched;
+                time, (int)root_data.current_depth, nodes);
+        *total_nodes += nodes;
     }
-    time = elapsed_time(&bench_timer);
+    return elapsed_time(&bench_timer);
+}
+
+/*
+ * Search all of the benchmark positions either to the given depth or for the
+ * given amount of time. The positions come directly from Glaurung's benchmark
+ * suite.
+ */
+void benchmark(int depth, int time_limit)
+{
+    uint64_t total_nodes = 0;
+    int time = search_positions(depth, time_limit, &total_nodes);
     printf("aggregate nodes %"PRIu64" time %d nps %"PRIu64"\n",
             total_nodes, time, total_nodes/(time+1)*1000);
 }
 
+/*
+ * Search the benchmark positions to a fixed depth with 1, 2, 4, ... up to
+ * |max_threads| search threads, and report the time to depth and the speedup
+ * over a single thread at each thread count. The hash tables are cleared
+ * before each run so that every thread count starts from the same state.
+ */
+void smp_benchmark(int depth, int max_threads)
+{
+    int saved_threads = options.num_threads;
+    max_threads = CLAMP(max_threads, 1, MAX_SEARCH_THREADS);
+    int times[MAX_SEARCH_THREADS+1];
+    uint64_t nodes[MAX_SEARCH_THREADS+1];
+    int counts[MAX_SEARCH_THREADS+1];
+    int runs = 0;
+    for (int threads=1; ; threads=MIN(2*threads, max_threads)) {
+        options.num_threads = threads;
+        clear_transposition_table();
+        clear_pawn_table();
+        clear_pv_cache();
+        nodes[runs] = 0;
+        times[runs] = search_positions(depth, 0, &nodes[runs]);
+        counts[runs++] = threads;
+        if (threads == max_threads) break;
+    }
+    options.num_threads = saved_threads;
+
+    printf("threads  time (ms)         nodes        nps  speedup\n");
+    for (int i=0; i<runs; ++i) {
+        printf("%7d %10d %13"PRIu64" %10"PRIu64" %7.2fx\n",
+                counts[i], times[i], nodes[i],
+                nodes[i]/(times[i]+1)*1000,
+                (double)times[0] / MAX(times[i], 1));
+    }
+}
+
+/*
+ * Search the benchmark positions to a fixed depth with each of the given
+ * hash sizes, once with the table in normal pages and once with huge pages,
+ * and report the nps of each. The pawn and pv caches are cleared before
+ * each run, and the hash table is put back as it was at the end.
+ */
+void page_benchmark(int depth, const int* hash_mbytes, int num_sizes)
+{
+    bool saved_large_pages = options.large_pages;
+    const char* modes[2];
+    int times[2];
+    uint64_t nodes[2];
+    printf("hash MB  pages                    time (ms)         nodes"
+            "        nps\n");
+    for (int i=0; i<num_sizes; ++i) {
+        for (int large=0; large<2; ++large) {
+            options.large_pages = large;
+            init_transposition_table(hash_mbytes[i] * (1ull<<20));
+            modes[large] = get_transposition_page_mode();
+            clear_pawn_table();
+            clear_pv_cache();
+            nodes[large] = 0;
+            times[large] = search_positions(depth, 0, &nodes[large]);
+        }
+        for (int large=0; large<2; ++large) {
+            printf("%7d  %-22s %10d %13"PRIu64" %10"PRIu64"\n",
+                    hash_mbytes[i], modes[large], times[large],
+                    nodes[large], nodes[large]/(times[large]+1)*1000);
+        }
+    }
+    options.large_pages = saved_large_pages;
+    int mbytes = 0;
+    sscanf(get_option_string("Hash"), "%d", &mbytes);
+    init_transposition_table(mbytes * (1ull<<20));
+}
+
+/*
+ * Search the benchmark positions to a fixed depth under each hash
+ * replacement policy, starting from an empty table of the given size, and
+ * report the time taken and the table hit rate of each. A small table makes
+ * the differences easier to see.
+ */
+void hash_policy_benchmark(int depth, int hash_mbytes)
+{
+    const char* names[3] =
+        { "aged depth", "two tier", "equidistributed draft" };
+    replace_policy_t saved_policy = options.hash_replacement;
+    int times[3];
+    uint64_t nodes[3], hits[3], misses[3];
+    for (int policy=0; policy<3; ++policy) {
+        options.hash_replacement = policy;
+        init_transposition_table(hash_mbytes * (1ull<<20));
+        clear_pawn_table();
+        clear_pv_cache();
+        nodes[policy] = 0;
+        times[policy] = search_positions(depth, 0, &nodes[policy]);
+        get_transposition_hit_counts(&hits[policy], &misses[policy]);
+    }
+    printf("policy                   time (ms)         nodes    hit rate\n");
+    for (int policy=0; policy<3; ++policy) {
+        printf("%-22s %11d %13"PRIu64" %10.2f%%\n", names[policy],
+                times[policy], nodes[policy], 100. * hits[policy] /
+                (hits[policy] + misses[policy] + 1));
+    }
+    options.hash_replacement = saved_policy;
+    int mbytes = 0;
+    sscanf(get_option_string("Hash"), "%d", &mbytes);
+    init_transposition_table(mbytes * (1ull<<20));
+}
+
+/*
+ * Evaluate the benchmark positions and every position one legal move away
+ * from them, |passes| times over, and report full_eval throughput. The time
+ * spent making and unmaking the moves is measured separately and taken out.
+ */
+void eval_benchmark(int passes)
+{
+    position_t pos;
+    milli_timer_t timer;
+    init_timer(&timer);
+    int make_time = 0, eval_time = 0;
+    uint64_t evals = 0;
+    int checksum = 0;
+    for (int i=0; positions[i]; ++i) {
+        set_position(&pos, positions[i]);
+        move_t moves[256];
+        int num_moves = generate_legal_moves(&pos, moves);
+        for (int with_eval=0; with_eval<2; ++with_eval) {
+            start_timer(&timer);
+            for (int pass=0; pass<passes; ++pass) {
+                for (int j=0; j<num_moves; ++j) {
+                    undo_info_t undo;
+                    eval_data_t ed;
+                    do_move(&pos, moves[j], &undo);
+                    if (with_eval) checksum += full_eval(&pos, &ed);
+                    undo_move(&pos, moves[j], &undo);
+                }
+            }
+            int time = stop_timer(&timer);
+            if (with_eval) eval_time += time;
+            else make_time += time;
+        }
+        evals += (uint64_t)passes * num_moves;
+    }
+    int time = MAX(eval_time - make_time, 1);
+    printf("evals %"PRIu64" time %d ms (make/unmake %d ms) "
+            "evals/s %"PRIu64" checksum %d\n",
+            evals, time, make_time, evals*1000/time, checksum);
+}
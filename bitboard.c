@@ -29,6 +29,178 @@ const int bit_table[64] = {
     61, 22, 43, 51, 60, 42, 59, 58
 };
 
+#ifdef BITBOARD_MOVEGEN
+bitboard_t knight_attacks[64];
+bitboard_t king_attacks[64];
+bitboard_t pawn_attacks[2][64];
+bitboard_t between_mask[64][64];
+magic_t bishop_magics[64];
+magic_t rook_magics[64];
+static bitboard_t slider_attacks[5248 + 102400];
+
+static const int bishop_dirs[4][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+static const int rook_dirs[4][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+
+/*
+ * Count the set bits in |bb|. Only used for initialization.
+ */
+static int count_bits(bitboard_t bb)
+{
+    int count = 0;
+    for (; bb; clear_first_bit(bb)) ++count;
+    return count;
+}
+
+/*
+ * A small xorshift generator for finding magics. The seeds for each rank
+ * were picked because they find magics quickly.
+ */
+static uint64_t random_state;
+static const uint64_t magic_seeds[8] = {
+    728, 10316, 55013, 32803, 12281, 15100, 16645, 255
+};
+
+static uint64_t random_bits(void)
+{
+    uint64_t state = random_state;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    random_state = state;
+    return state * 0x2545f4914f6cdd1dull;
+}
+
+/*
+ * Get the set of squares reachable by stepping once from |ind| by each of
+ * the given (rank, file) offsets.
+ */
+static bitboard_t step_attacks(int ind, const int (*steps)[2], int num_steps)
+{
+    bitboard_t attacks = EMPTY_BB;
+    for (int i=0; i<num_steps; ++i) {
+        int rank = ind / 8 + steps[i][0], file = ind % 8 + steps[i][1];
+        if (rank < 0 || rank > 7 || file < 0 || file > 7) continue;
+        attacks |= 1ull << (rank*8 + file);
+    }
+    return attacks;
+}
+
+/*
+ * Get the squares attacked by a slider on |ind| that moves in the given
+ * directions, when the squares in |occupied| are occupied. This is the slow
+ * way, used to fill in the lookup tables.
+ */
+static bitboard_t slide_attacks(int ind,
+        const int (*dirs)[2],
+        bitboard_t occupied)
+{
+    bitboard_t attacks = EMPTY_BB;
+    for (int i=0; i<4; ++i) {
+        int rank = ind / 8 + dirs[i][0], file = ind % 8 + dirs[i][1];
+        for (; rank >= 0 && rank < 8 && file >= 0 && file < 8;
+                rank += dirs[i][0], file += dirs[i][1]) {
+            bitboard_t bit = 1ull << (rank*8 + file);
+            attacks |= bit;
+            if (occupied & bit) break;
+        }
+    }
+    return attacks;
+}
+
+/*
+ * Fill in the attack tables for one kind of slider, using the space starting
+ * at |table|, and return the first unused entry. Without pext we need a
+ * magic multiplier for each square that maps every relevant occupancy to an
+ * index without destructive collisions, which we find by trial and error.
+ */
+static bitboard_t* init_magics(magic_t* magics,
+        const int (*dirs)[2],
+        bitboard_t* table)
+{
+    static bitboard_t occupancy[4096], reference[4096];
+    static int tried[4096];
+    int attempt = 0;
+    for (int ind=0; ind<64; ++ind) {
+        magic_t* m = &magics[ind];
+        // Pieces on the edge of the board never block anything.
+        bitboard_t edges = ((RANK_1_BB | RANK_8_BB) & ~rank_mask[ind / 8]) |
+            ((FILE_A_BB | FILE_H_BB) & ~file_mask[ind % 8]);
+        m->mask = slide_attacks(ind, dirs, EMPTY_BB) & ~edges;
+        m->shift = 64 - count_bits(m->mask);
+        m->attacks = table;
+
+        // Enumerate all subsets of the mask.
+        int size = 0;
+        bitboard_t occupied = EMPTY_BB;
+        do {
+            occupancy[size] = occupied;
+            reference[size++] = slide_attacks(ind, dirs, occupied);
+            occupied = (occupied - m->mask) & m->mask;
+        } while (occupied);
+        table += size;
+
+#ifdef USE_PEXT
+        m->magic = 0;
+        for (int i=0; i<size; ++i) {
+            m->attacks[magic_index(m, occupancy[i])] = reference[i];
+        }
+#else
+        random_state = magic_seeds[ind / 8];
+        for (int i=0; i<size; ) {
+            do {
+                m->magic = random_bits() & random_bits() & random_bits();
+            } while (count_bits((m->magic * m->mask) >> 56) < 6);
+            ++attempt;
+            for (i=0; i<size; ++i) {
+                int index = magic_index(m, occupancy[i]);
+                if (tried[index] < attempt) {
+                    tried[index] = attempt;
+                    m->attacks[index] = reference[i];
+                } else if (m->attacks[index] != reference[i]) break;
+            }
+        }
+#endif
+    }
+    return table;
+}
+
+/*
+ * Set up the attack tables used for bitboard move generation.
+ */
+static void init_attack_bitboards(void)
+{
+    const int knight_steps[8][2] = { {2, 1}, {2, -1}, {-2, 1}, {-2, -1},
+        {1, 2}, {1, -2}, {-1, 2}, {-1, -2} };
+    const int king_steps[8][2] = { {1, 1}, {1, 0}, {1, -1}, {0, 1},
+        {0, -1}, {-1, 1}, {-1, 0}, {-1, -1} };
+    const int pawn_steps[2][2][2] = { { {1, 1}, {1, -1} },
+        { {-1, 1}, {-1, -1} } };
+    for (int ind=0; ind<64; ++ind) {
+        knight_attacks[ind] = step_attacks(ind, knight_steps, 8);
+        king_attacks[ind] = step_attacks(ind, king_steps, 8);
+        pawn_attacks[WHITE][ind] = step_attacks(ind, pawn_steps[WHITE], 2);
+        pawn_attacks[BLACK][ind] = step_attacks(ind, pawn_steps[BLACK], 2);
+    }
+    bitboard_t* table = init_magics(bishop_magics, bishop_dirs,
+            slider_attacks);
+    table = init_magics(rook_magics, rook_dirs, table);
+    assert(table == slider_attacks + 5248 + 102400);
+
+    for (int from=0; from<64; ++from) {
+        for (int to=0; to<64; ++to) {
+            between_mask[from][to] = EMPTY_BB;
+            if (bishop_attacks(from, EMPTY_BB) & set_mask[to]) {
+                between_mask[from][to] = bishop_attacks(from, set_mask[to]) &
+                    bishop_attacks(to, set_mask[from]);
+            } else if (rook_attacks(from, EMPTY_BB) & set_mask[to]) {
+                between_mask[from][to] = rook_attacks(from, set_mask[to]) &
+                    rook_attacks(to, set_mask[from]);
+            }
+        }
+    }
+}
+#endif
+
 /*
  * Set all static bitboards to their appropriate values.
  */
@@ -62,6 +234,9 @@ void init_bitboards(void)
         in_front_mask[WHITE][sq] &= file_mask[sq_file];
         in_front_mask[BLACK][sq] &= file_mask[sq_file];
     }
+#ifdef BITBOARD_MOVEGEN
+    init_attack_bitboards();
+#endif
 }
 
 /*
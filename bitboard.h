@@ -47,6 +47,44 @@ extern const int bit_table[64];
 #define sq_bit_is_set(bb, sq)   ((bb) & set_mask[square_to_index(sq)])
 #define first_bit(bb)           \
     (bit_table[(((bb) & (~(bb)+1)) * 0x0218A392CD3D5DBFull) >> 58])
+#define clear_first_bit(bb)     ((bb) &= (bb)-1)
+
+#ifdef BITBOARD_MOVEGEN
+// Attack sets for move generation, indexed by square index (a1=0, h8=63).
+// Sliding attacks are looked up through magic multiplication, or through
+// pext on processors that have BMI2.
+#ifdef __BMI2__
+#include <immintrin.h>
+#define USE_PEXT
+#endif
+
+typedef struct {
+    bitboard_t mask;
+    bitboard_t magic;
+    bitboard_t* attacks;
+    int shift;
+} magic_t;
+
+extern bitboard_t knight_attacks[64];
+extern bitboard_t king_attacks[64];
+extern bitboard_t pawn_attacks[2][64];
+extern bitboard_t between_mask[64][64];
+extern magic_t bishop_magics[64];
+extern magic_t rook_magics[64];
+
+#ifdef USE_PEXT
+#define magic_index(m, occ)     _pext_u64((occ), (m)->mask)
+#else
+#define magic_index(m, occ)     \
+    ((((occ) & (m)->mask) * (m)->magic) >> (m)->shift)
+#endif
+#define bishop_attacks(ind, occ)    \
+    (bishop_magics[ind].attacks[magic_index(&bishop_magics[ind], (occ))])
+#define rook_attacks(ind, occ)      \
+    (rook_magics[ind].attacks[magic_index(&rook_magics[ind], (occ))])
+#define queen_attacks(ind, occ)     \
+    (bishop_attacks(ind, occ) | rook_attacks(ind, occ))
+#endif
 
 #ifdef __cplusplus
 }
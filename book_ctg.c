@@ -1,6 +1,11 @@
 
 #include "daydreamer.h"
 #include <string.h>
+#ifdef HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /*
  * Interface to ctg format books. The huffman codes and ctg move decoding are
@@ -13,8 +18,19 @@
 #define read_32(buf, pos)   \
     ((buf[pos]<<24) + (buf[pos+1]<<16) + (buf[(pos)+2]<<8) + (buf[(pos+3)+2]))
 
-FILE* ctg_file = NULL;
-FILE* cto_file = NULL;
+extern const char glyphs[];
+
+#define CTG_PAGE_SIZE   4096
+
+/*
+ * Read-only mappings of the .ctg and .cto files. When a mapping is present,
+ * pages and index slots are resolved by pointer arithmetic instead of a
+ * seek and read per probe. A NULL |data| means we fall back to stdio.
+ */
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+} ctg_map_t;
 
 typedef struct {
     int pad;
@@ -22,30 +38,108 @@ typedef struct {
     int high;
 } page_bounds_t;
 
-page_bounds_t page_bounds;
+/*
+ * A page that has been loaded during the current lookup, so that it can be
+ * reused by later probes that land on the same page.
+ */
+typedef struct {
+    int index;
+    const uint8_t* data;
+    uint8_t buf[CTG_PAGE_SIZE];
+} ctg_page_t;
+
+typedef struct {
+    int queries;
+    int slot_reads;
+    int page_reads;
+} ctg_io_stats_t;
+
+/*
+ * A fixed-capacity least-recently-used index. Nodes are identified by their
+ * position in the node arrays, which also index the payload that the owner
+ * keeps alongside. Lookups go through a chained hash on the key, and
+ * recency is tracked with a doubly linked list threaded through the nodes.
+ */
+typedef struct {
+    int capacity;
+    int size;
+    int head;
+    int tail;
+    int num_buckets;
+    int* buckets;
+    int* keys;
+    int* prev;
+    int* next;
+    int* chain;
+    int hits;
+    int misses;
+    int evictions;
+} ctg_lru_t;
+
+// Size of the page and slot caches given to each newly opened book.
+#define DEFAULT_CTG_CACHE_BYTES     (1<<20)
+static int ctg_cache_bytes = DEFAULT_CTG_CACHE_BYTES;
+
+/*
+ * An optional sidecar index, built offline by build_ctg_index, which maps the
+ * zobrist key of every book position directly to its entry. The file is a
+ * header, followed by the raw move lists and statistics of each entry, and
+ * then a table of (key, offset) records sorted by key. All fields are
+ * big-endian. When present, it replaces the signature/.cto/page lookup with
+ * a binary search.
+ */
+#define CTG_INDEX_MAGIC         "DDCTGIX1"
+#define CTG_INDEX_VERSION       1
+#define CTG_INDEX_HEADER_SIZE   64
+#define CTG_INDEX_RECORD_SIZE   12
+// Size of the largest possible entry data: a move list and the statistics.
+#define CTG_MAX_ENTRY_DATA      (256 + 33)
+
+typedef struct {
+    FILE* file;
+    ctg_map_t map;
+    uint64_t num_records;
+    uint64_t data_offset;
+    uint64_t records_offset;
+} ctg_index_t;
+
+/*
+ * Everything needed to probe one open book. Apart from the caches and the
+ * statistics, nothing here changes after the book is opened, so probes from
+ * different threads only need to coordinate on those. Reads that don't go
+ * through a mapping use pread where it's available, which doesn't disturb
+ * the shared file position, and otherwise hold |lock| across the seek and
+ * read.
+ */
+struct ctg_book_s {
+    FILE* ctg_file;
+    FILE* cto_file;
+    ctg_map_t ctg_map;
+    ctg_map_t cto_map;
+    page_bounds_t page_bounds;
+    ctg_index_t index;
+    mutex_t lock;
+    // Copies of recently read pages, and the .cto slots used to find them.
+    // These only come into play when a file is read through stdio; mapped
+    // files are already cached by the operating system.
+    ctg_lru_t page_lru;
+    ctg_lru_t slot_lru;
+    uint8_t* page_cache;
+    int* slot_cache;
+    ctg_io_stats_t io_stats;
+    // Resolve the children of a book position with a single batched lookup
+    // rather than one full lookup per move.
+    bool batch_child_lookups;
+};
+
+// The book used by the engine, and by the functions that don't take a book.
+static ctg_book_t* ctg_book = NULL;
 
 typedef struct {
     uint8_t buf[64];
     int buf_len;
 } ctg_signature_t;
 
-typedef struct {
-    int num_moves;
-    uint8_t moves[100];
-    int total;
-    int wins;
-    int losses;
-    int draws;
-    int unknown1;
-    int avg_rating_games;
-    int avg_rating_score;
-    int perf_rating_games;
-    int perf_rating_score;
-    int recommendation;
-    int unknown2;
-    int comment;
-} ctg_entry_t;
-
 typedef struct {
     int file_from;
     int file_to;
@@ -54,16 +148,88 @@ typedef struct {
 } ctg_move_t;
 
 static move_t squares_to_move(position_t* pos, square_t from, square_t to);
-static bool ctg_get_entry(position_t* pos, ctg_entry_t* entry);
-static bool ctg_pick_move(position_t* pos, ctg_entry_t* entry, move_t* move);
+static move_t byte_to_move(position_t* pos, uint8_t byte);
+static int ctg_signature_cmp(const uint8_t* a, int a_len,
+        const uint8_t* b, int b_len);
+static bool load_ctg_index(ctg_book_t* book,
+        char* filename,
+        uint64_t ctg_size);
+static void close_ctg_index(ctg_book_t* book);
+static bool ctg_index_lookup(ctg_book_t* book,
+        hashkey_t key,
+        ctg_entry_t* entry);
+static void init_book_cache(ctg_book_t* book, int max_bytes);
+static void lru_free(ctg_lru_t* lru);
+static bool ctg_get_entry(ctg_book_t* book,
+        position_t* pos,
+        ctg_entry_t* entry,
+        ctg_page_t* page);
+static int ctg_collect_moves(ctg_book_t* book,
+        position_t* pos,
+        ctg_entry_t* entry,
+        ctg_page_t* page,
+        ctg_book_move_t* book_moves);
+static bool ctg_pick_move(ctg_book_move_t* book_moves,
+        int num_moves,
+        move_t* move);
 
 /*
- * Initialize the ctg-format opening book with the given filename. The
- * filename gives the .ctg file, and there must be corresponding .cto and .ctb
- * files in the same directory. Note that all these methods depend on global
- * state in the form of ctg and cto file pointers.
+ * Return the size of |file| in bytes, or 0 if it can't be determined.
+ * Unlike ftell, this works for files over 2GB in 32-bit builds.
  */
-bool init_ctg_book(char* filename)
+static uint64_t book_file_size(FILE* file)
+{
+    if (fseeko(file, 0, SEEK_END)) return 0;
+    int64_t size = ftello(file);
+    return size < 0 ? 0 : (uint64_t)size;
+}
+
+/*
+ * Map the contents of |file| into memory. Returns false if mapping isn't
+ * supported or fails, or if the file is too big to map in this build, in
+ * which case the caller should use stdio instead.
+ */
+static bool map_book_file(FILE* file, ctg_map_t* map, bool random_access)
+{
+    map->data = NULL;
+    map->size = 0;
+#ifdef HAS_MMAP
+    struct stat st;
+    int fd = fileno(file);
+    if (fstat(fd, &st) || st.st_size <= 0) return false;
+    if ((uint64_t)st.st_size > SIZE_MAX) return false;
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) return false;
+    if (random_access) madvise(data, st.st_size, MADV_RANDOM);
+    map->data = data;
+    map->size = st.st_size;
+    return true;
+#else
+    (void)file;
+    (void)random_access;
+    return false;
+#endif
+}
+
+/*
+ * Release a mapping created by map_book_file.
+ */
+static void unmap_book_file(ctg_map_t* map)
+{
+#ifdef HAS_MMAP
+    if (map->data) munmap((void*)map->data, map->size);
+#endif
+    map->data = NULL;
+    map->size = 0;
+}
+
+/*
+ * Open the ctg-format opening book with the given filename. The filename
+ * gives the .ctg file, and there must be corresponding .cto and .ctb files
+ * in the same directory. Returns NULL if the book can't be opened. The
+ * returned book may be probed concurrently from multiple threads.
+ */
+ctg_book_t* open_ctg_book(char* filename)
 {
     int name_len = strlen(filename);
     assert(filename[name_len-3] == 'c' &&
@@ -71,29 +237,80 @@ bool init_ctg_book(char* filename)
             filename[name_len-1] == 'g');
     char fbuf[1024];
     strcpy(fbuf, filename);
-    if (ctg_file) {
-        assert(cto_file);
-        fclose(ctg_file);
-        fclose(cto_file);
-    }
-    ctg_file = fopen(fbuf, "r");
+    ctg_book_t* book = calloc(1, sizeof(ctg_book_t));
+    if (!book) return NULL;
+    mutex_init(&book->lock);
+    book->batch_child_lookups = true;
+    book->ctg_file = fopen(fbuf, "r");
     fbuf[name_len-1] = 'o';
-    cto_file = fopen(fbuf, "r");
+    book->cto_file = fopen(fbuf, "r");
     fbuf[name_len-1] = 'b';
     FILE* ctb_file = fopen(fbuf, "r");
     fbuf[name_len-1] = 'g';
-    if (!ctg_file || !cto_file || !ctb_file) {
+    if (!book->ctg_file || !book->cto_file || !ctb_file) {
         printf("info string Couldn't load book %s\n", fbuf);
-        return false;
+        if (ctb_file) fclose(ctb_file);
+        close_ctg_book(book);
+        return NULL;
     }
 
-    // Read out upper and lower page limits.
-    fread(&page_bounds, 12, 1, ctb_file);
-    page_bounds.low = my_ntohl((uint32_t)page_bounds.low);
-    page_bounds.high = my_ntohl((uint32_t)page_bounds.high);
-    assert(page_bounds.low <= page_bounds.high);
+    // Read out upper and lower page limits. The .ctb file is only read once,
+    // so it isn't worth keeping a mapping around for it.
+    page_bounds_t* page_bounds = &book->page_bounds;
+    ctg_map_t ctb_map;
+    if (map_book_file(ctb_file, &ctb_map, false) && ctb_map.size >= 12) {
+        memcpy(page_bounds, ctb_map.data, 12);
+    } else if (fread(page_bounds, 12, 1, ctb_file) != 1) {
+        memset(page_bounds, 0, sizeof(page_bounds_t));
+    }
+    unmap_book_file(&ctb_map);
+    page_bounds->low = my_ntohl((uint32_t)page_bounds->low);
+    page_bounds->high = my_ntohl((uint32_t)page_bounds->high);
+    assert(page_bounds->low <= page_bounds->high);
     fclose(ctb_file);
-    return true;
+
+    // Map the page and index files. Either one may fail independently, in
+    // which case lookups on that file go through stdio.
+    map_book_file(book->ctg_file, &book->ctg_map, true);
+    map_book_file(book->cto_file, &book->cto_map, true);
+    init_book_cache(book, ctg_cache_bytes);
+
+    // Use a compiled index if there's an up to date one alongside the book.
+    uint64_t ctg_size = book_file_size(book->ctg_file);
+    fbuf[name_len-1] = 'i';
+    load_ctg_index(book, fbuf, ctg_size);
+    return book;
+}
+
+/*
+ * Release all resources associated with |book|. No other thread may be
+ * using the book.
+ */
+void close_ctg_book(ctg_book_t* book)
+{
+    if (!book) return;
+    unmap_book_file(&book->ctg_map);
+    unmap_book_file(&book->cto_map);
+    if (book->ctg_file) fclose(book->ctg_file);
+    if (book->cto_file) fclose(book->cto_file);
+    close_ctg_index(book);
+    lru_free(&book->page_lru);
+    lru_free(&book->slot_lru);
+    free(book->page_cache);
+    free(book->slot_cache);
+    mutex_destroy(&book->lock);
+    free(book);
+}
+
+/*
+ * Make the ctg book with the given filename the engine's book, replacing
+ * any book that was already loaded.
+ */
+bool init_ctg_book(char* filename)
+{
+    close_ctg_book(ctg_book);
+    ctg_book = open_ctg_book(filename);
+    return ctg_book != NULL;
 }
 
 /*
@@ -103,12 +320,96 @@ bool init_ctg_book(char* filename)
 move_t get_ctg_book_move(position_t* pos)
 {
     move_t move;
-    ctg_entry_t entry;
-    if (!ctg_get_entry(pos, &entry)) return NO_MOVE;
-    if (!ctg_pick_move(pos, &entry, &move)) return NO_MOVE;
+    ctg_book_move_t book_moves[MAX_CTG_BOOK_MOVES];
+    int num_moves = get_ctg_book_moves(pos, book_moves);
+    for (int i=0; i<num_moves; ++i) {
+        print_ctg_book_move(&book_moves[i]);
+        printf("\n");
+    }
+    if (!ctg_pick_move(book_moves, num_moves, &move)) return NO_MOVE;
     return move;
 }
 
+/*
+ * Fill |book_moves| with every book move available in |pos| whose resulting
+ * position is also in |book|, and return the number of moves found. This
+ * doesn't print anything, so it's suitable for callers that format their
+ * own output. |pos| is modified during the probe but restored before
+ * returning, so concurrent probes need their own positions.
+ */
+int probe_ctg_book(ctg_book_t* book,
+        position_t* pos,
+        ctg_book_move_t* book_moves)
+{
+    ctg_entry_t entry;
+    ctg_page_t page;
+    page.data = NULL;
+    atomic_add(&book->io_stats.queries, 1);
+    if (!ctg_get_entry(book, pos, &entry, &page)) return 0;
+    return ctg_collect_moves(book, pos, &entry, &page, book_moves);
+}
+
+/*
+ * Probe the engine's book, as in probe_ctg_book.
+ */
+int get_ctg_book_moves(position_t* pos, ctg_book_move_t* book_moves)
+{
+    if (!ctg_book) return 0;
+    return probe_ctg_book(ctg_book, pos, book_moves);
+}
+
+/*
+ * Choose whether the positions reached by book moves in the engine's book
+ * are looked up in one batch, or one at a time. Batching is the default;
+ * the unbatched path is kept for comparison.
+ */
+void set_ctg_child_batching(bool batch)
+{
+    if (ctg_book) ctg_book->batch_child_lookups = batch;
+}
+
+/*
+ * Reset the counters reported by print_ctg_io_stats.
+ */
+void clear_ctg_io_stats(void)
+{
+    if (ctg_book) memset(&ctg_book->io_stats, 0, sizeof(ctg_io_stats_t));
+}
+
+/*
+ * Print the number of index slot and page reads done on behalf of book
+ * queries, in total and per query.
+ */
+void print_ctg_io_stats(void)
+{
+    if (!ctg_book) return;
+    ctg_io_stats_t ctg_io_stats = ctg_book->io_stats;
+    int queries = MAX(ctg_io_stats.queries, 1);
+    printf("info string ctg queries %d", ctg_io_stats.queries);
+    printf(" slot reads %d (%.2f/query)", ctg_io_stats.slot_reads,
+            (float)ctg_io_stats.slot_reads / queries);
+    printf(" page reads %d (%.2f/query)\n", ctg_io_stats.page_reads,
+            (float)ctg_io_stats.page_reads / queries);
+}
+
+/*
+ * Print a book move and its statistics as a single json object, without a
+ * trailing newline.
+ */
+void print_ctg_book_move(const ctg_book_move_t* bm)
+{
+    char move_str[7];
+    move_to_coord_str(bm->move, move_str);
+    printf("{\"move\": \"%s\" ,\"weight\": %6"PRIu64", \"wins\":%6d,"
+           "\"draws\":%6d, \"losses\":%6d, \"rec\":%3d, "
+           "\"note\":%2d, \"avg_games\":%6d,\"avg_score\":%9d, "
+           "\"perf_games\":%6d, \"perf_score\":%9d}",
+           move_str, bm->weight, bm->wins, bm->draws, bm->losses,
+           bm->recommendation, bm->annotation, bm->avg_rating_games,
+           bm->avg_rating_score, bm->perf_rating_games,
+           bm->perf_rating_score);
+}
+
 /*
  * Push the given bits on to the end of |sig|. This is a helper function that
  * makes the huffman encoding of positions a little cleaner.
@@ -149,6 +450,23 @@ static void print_signature(ctg_signature_t* sig)
     printf("\n");
 }
 
+/*
+ * Huffman codes for the contents of a square, indexed by piece. Bits are
+ * appended to a signature least significant bit first.
+ */
+static const struct {
+    uint8_t bits;
+    uint8_t num_bits;
+} ctg_piece_codes[16] = {
+    [EMPTY] = { 0x00, 1 },
+    [WP] = { 0x03, 3 }, [BP] = { 0x07, 3 },
+    [WN] = { 0x09, 5 }, [BN] = { 0x19, 5 },
+    [WB] = { 0x05, 5 }, [BB] = { 0x15, 5 },
+    [WR] = { 0x0D, 5 }, [BR] = { 0x1D, 5 },
+    [WQ] = { 0x11, 6 }, [BQ] = { 0x31, 6 },
+    [WK] = { 0x01, 6 }, [BK] = { 0x21, 6 },
+};
+
 /*
  * Compute the huffman encoding of the given position, according to
  * ctg convention.
@@ -177,22 +495,9 @@ static void position_to_ctg_signature(position_t* pos, ctg_signature_t* sig)
             piece_t piece = flip_board ?
                 flip_piece[pos->board[sq]] :
                 pos->board[sq];
-            switch (piece) {
-                case EMPTY: bits = 0x0; num_bits = 1; break;
-                case WP: bits = 0x3; num_bits = 3; break;
-                case BP: bits = 0x7; num_bits = 3; break;
-                case WN: bits = 0x9; num_bits = 5; break;
-                case BN: bits = 0x19; num_bits = 5; break;
-                case WB: bits = 0x5; num_bits = 5; break;
-                case BB: bits = 0x15; num_bits = 5; break;
-                case WR: bits = 0xD; num_bits = 5; break;
-                case BR: bits = 0x1D; num_bits = 5; break;
-                case WQ: bits = 0x11; num_bits = 6; break;
-                case BQ: bits = 0x31; num_bits = 6; break;
-                case WK: bits = 0x1; num_bits = 6; break;
-                case BK: bits = 0x21; num_bits = 6; break;
-                default: assert(false);
-            }
+            bits = ctg_piece_codes[piece].bits;
+            num_bits = ctg_piece_codes[piece].num_bits;
+            assert(num_bits);
             append_bits_reverse(sig, bits, bit_position, num_bits);
             bit_position += num_bits;
         }
@@ -247,6 +552,139 @@ static void position_to_ctg_signature(position_t* pos, ctg_signature_t* sig)
     if (castle) sig->buf[0] |= 1<<6;
 }
 
+/*
+ * Read the bit at |bit_position| in a signature.
+ */
+static int signature_bit(const uint8_t* sig, int bit_position)
+{
+    return (sig[bit_position/8] >> (7 - bit_position%8)) & 1;
+}
+
+/*
+ * Decode the huffman signature |sig| back into the set of positions that
+ * encode to it. A signature describes the board from the point of view of
+ * the side to move, and drops the distinction between a position and its
+ * mirror image when neither side can castle, so there are up to four such
+ * positions. Each candidate is checked by encoding it again, so only
+ * positions that really map to |sig| are returned. Returns the number of
+ * positions written to |positions|.
+ */
+static int ctg_signature_to_positions(const uint8_t* sig, position_t* positions)
+{
+    int sig_len = sig[0] % 32;
+    if (sig_len < 2) return 0;
+    int bit_position = 8, max_bits = sig_len*8;
+
+    // Decode the contents of each square, in the same order they're encoded.
+    piece_t board[8][8];
+    for (int file=0; file<8; ++file) {
+        for (int rank=0; rank<8; ++rank) {
+            int bits = 0, num_bits = 0;
+            piece_t piece = OUT_OF_BOUNDS;
+            while (piece == OUT_OF_BOUNDS && num_bits < 6) {
+                if (bit_position >= max_bits) return 0;
+                bits |= signature_bit(sig, bit_position++) << num_bits++;
+                for (piece_t p=EMPTY; p<=BK; ++p) {
+                    if (ctg_piece_codes[p].num_bits == num_bits &&
+                            ctg_piece_codes[p].bits == bits) piece = p;
+                }
+            }
+            if (piece == OUT_OF_BOUNDS) return 0;
+            board[file][rank] = piece;
+        }
+    }
+
+    // Castling and en passant flags sit flush against the end of the last
+    // byte; see position_to_ctg_signature.
+    bool has_ep = sig[0] & (1<<5);
+    bool has_castle = sig[0] & (1<<6);
+    int flag_bit_length = (has_ep ? 3 : 0) + (has_castle ? 4 : 0);
+    int flag_bits = 0;
+    for (int i=0; i<flag_bit_length; ++i) {
+        flag_bits |= signature_bit(sig, max_bits - flag_bit_length + i) << i;
+    }
+    int ep = -1, castle = flag_bits;
+    if (has_ep) {
+        ep = 0;
+        for (int i=0; i<3; ++i) if (flag_bits & (1<<(2-i))) ep |= 1<<i;
+        castle >>= 3;
+    }
+
+    // Try each combination of flipping and mirroring.
+    int num_positions = 0;
+    for (int flip=0; flip<2; ++flip) {
+        for (int mirror=0; mirror<2; ++mirror) {
+            if (mirror && castle) continue;
+            piece_t actual[128];
+            memset(actual, 0, sizeof(actual));
+            for (int file=0; file<8; ++file) {
+                for (int rank=0; rank<8; ++rank) {
+                    square_t sq = create_square(file, rank);
+                    if (flip) sq = mirror_rank(sq);
+                    if (mirror) sq = mirror_file(sq);
+                    actual[sq] = flip ?
+                        flip_piece[board[file][rank]] : board[file][rank];
+                }
+            }
+
+            // Build an fen string so that set_position can take care of
+            // setting up castling and en passant properly.
+            char fen[128], *f = fen;
+            for (int rank=7; rank>=0; --rank) {
+                int empty_run = 0;
+                for (int file=0; file<8; ++file) {
+                    piece_t p = actual[create_square(file, rank)];
+                    if (p == EMPTY) {
+                        ++empty_run;
+                        continue;
+                    }
+                    if (empty_run) *f++ = '0' + empty_run;
+                    empty_run = 0;
+                    *f++ = glyphs[p];
+                }
+                if (empty_run) *f++ = '0' + empty_run;
+                if (rank) *f++ = '/';
+            }
+            *f++ = ' ';
+            *f++ = flip ? 'b' : 'w';
+            *f++ = ' ';
+            const char* rights = flip ? "kqKQ" : "KQkq";
+            if (castle & 4) *f++ = rights[0];
+            if (castle & 8) *f++ = rights[1];
+            if (castle & 1) *f++ = rights[2];
+            if (castle & 2) *f++ = rights[3];
+            if (!castle) *f++ = '-';
+            *f++ = ' ';
+            if (ep >= 0) {
+                *f++ = 'a' + (mirror ? 7-ep : ep);
+                *f++ = flip ? '3' : '6';
+            } else *f++ = '-';
+            strcpy(f, " 0 1");
+
+            position_t* pos = &positions[num_positions];
+            set_position(pos, fen);
+            if (pos->num_pieces[WHITE] < 1 || pos->num_pieces[BLACK] < 1 ||
+                    pos->board[pos->pieces[WHITE][0]] != WK ||
+                    pos->board[pos->pieces[BLACK][0]] != BK) continue;
+            color_t side = pos->side_to_move;
+            if (is_square_attacked(pos, pos->pieces[side^1][0], side)) {
+                continue;
+            }
+            ctg_signature_t check;
+            position_to_ctg_signature(pos, &check);
+            if (ctg_signature_cmp(check.buf, check.buf_len, sig, sig_len)) {
+                continue;
+            }
+            bool duplicate = false;
+            for (int i=0; i<num_positions; ++i) {
+                if (positions[i].hash == pos->hash) duplicate = true;
+            }
+            if (!duplicate) ++num_positions;
+        }
+    }
+    return num_positions;
+}
+
 /*
  * Convert a position's huffman code to a 4 byte hash.
  */
@@ -284,20 +722,279 @@ static int32_t ctg_signature_to_hash(ctg_signature_t* sig)
 }
 
 
+/*
+ * Release the storage held by |lru|.
+ */
+static void lru_free(ctg_lru_t* lru)
+{
+    free(lru->buckets);
+    free(lru->keys);
+    free(lru->prev);
+    free(lru->next);
+    free(lru->chain);
+    memset(lru, 0, sizeof(ctg_lru_t));
+}
+
+/*
+ * Forget all keys in |lru| and reset its statistics.
+ */
+static void lru_clear(ctg_lru_t* lru)
+{
+    for (int i=0; i<lru->num_buckets; ++i) lru->buckets[i] = -1;
+    lru->size = 0;
+    lru->head = lru->tail = -1;
+    lru->hits = lru->misses = lru->evictions = 0;
+}
+
+/*
+ * Allocate an lru index that can hold |capacity| keys. A capacity of zero
+ * gives an index that never holds anything.
+ */
+static void lru_init(ctg_lru_t* lru, int capacity)
+{
+    lru_free(lru);
+    if (capacity <= 0) return;
+    lru->capacity = capacity;
+    lru->num_buckets = 1;
+    while (lru->num_buckets < capacity) lru->num_buckets <<= 1;
+    lru->buckets = malloc(lru->num_buckets * sizeof(int));
+    lru->keys = malloc(capacity * sizeof(int));
+    lru->prev = malloc(capacity * sizeof(int));
+    lru->next = malloc(capacity * sizeof(int));
+    lru->chain = malloc(capacity * sizeof(int));
+    assert(lru->buckets && lru->keys && lru->prev && lru->next && lru->chain);
+    lru_clear(lru);
+}
+
+static int lru_bucket(ctg_lru_t* lru, int key)
+{
+    return (uint32_t)key * 2654435761u & (lru->num_buckets - 1);
+}
+
+/*
+ * Remove |node| from the recency list.
+ */
+static void lru_unlink(ctg_lru_t* lru, int node)
+{
+    if (lru->prev[node] >= 0) lru->next[lru->prev[node]] = lru->next[node];
+    else lru->head = lru->next[node];
+    if (lru->next[node] >= 0) lru->prev[lru->next[node]] = lru->prev[node];
+    else lru->tail = lru->prev[node];
+}
+
+/*
+ * Put |node| at the most recently used end of the list.
+ */
+static void lru_push_front(ctg_lru_t* lru, int node)
+{
+    lru->prev[node] = -1;
+    lru->next[node] = lru->head;
+    if (lru->head >= 0) lru->prev[lru->head] = node;
+    lru->head = node;
+    if (lru->tail < 0) lru->tail = node;
+}
+
+/*
+ * Find the node holding |key|, without counting the probe or changing the
+ * recency order. Returns -1 if the key isn't present.
+ */
+static int lru_lookup(ctg_lru_t* lru, int key)
+{
+    if (!lru->capacity) return -1;
+    int node = lru->buckets[lru_bucket(lru, key)];
+    while (node >= 0 && lru->keys[node] != key) node = lru->chain[node];
+    return node;
+}
+
+/*
+ * Find the node holding |key| and mark it most recently used. Returns -1 if
+ * the key isn't present.
+ */
+static int lru_find(ctg_lru_t* lru, int key)
+{
+    if (!lru->capacity) return -1;
+    int node = lru_lookup(lru, key);
+    if (node < 0) {
+        lru->misses++;
+        return -1;
+    }
+    lru->hits++;
+    if (node != lru->head) {
+        lru_unlink(lru, node);
+        lru_push_front(lru, node);
+    }
+    return node;
+}
+
+/*
+ * Claim a node for |key|, which must not already be present, evicting the
+ * least recently used key if the index is full. Returns -1 if the index has
+ * no capacity.
+ */
+static int lru_insert(ctg_lru_t* lru, int key)
+{
+    if (!lru->capacity) return -1;
+    int node;
+    if (lru->size < lru->capacity) {
+        node = lru->size++;
+    } else {
+        node = lru->tail;
+        lru_unlink(lru, node);
+        int* link = &lru->buckets[lru_bucket(lru, lru->keys[node])];
+        while (*link != node) link = &lru->chain[*link];
+        *link = lru->chain[node];
+        lru->evictions++;
+    }
+    lru->keys[node] = key;
+    int bucket = lru_bucket(lru, key);
+    lru->chain[node] = lru->buckets[bucket];
+    lru->buckets[bucket] = node;
+    lru_push_front(lru, node);
+    return node;
+}
+
+/*
+ * Size the page and slot caches of |book| to use about |max_bytes| in total.
+ * Slots are tiny, so we keep several per page. Zero disables caching.
+ */
+static void init_book_cache(ctg_book_t* book, int max_bytes)
+{
+    int num_pages = MAX(max_bytes, 0) / CTG_PAGE_SIZE;
+    mutex_lock(&book->lock);
+    free(book->page_cache);
+    free(book->slot_cache);
+    book->page_cache = NULL;
+    book->slot_cache = NULL;
+    lru_init(&book->page_lru, num_pages);
+    lru_init(&book->slot_lru, 4*num_pages);
+    if (num_pages) {
+        book->page_cache = malloc((size_t)num_pages * CTG_PAGE_SIZE);
+        book->slot_cache = malloc(4 * num_pages * sizeof(int));
+        assert(book->page_cache && book->slot_cache);
+    }
+    mutex_unlock(&book->lock);
+}
+
+/*
+ * Set the cache size used for books opened from now on, and resize the
+ * cache of the engine's book to match.
+ */
+void init_ctg_cache(const int max_bytes)
+{
+    ctg_cache_bytes = MAX(max_bytes, 0);
+    if (ctg_book) init_book_cache(ctg_book, ctg_cache_bytes);
+}
+
+/*
+ * Empty the page and slot caches of the engine's book.
+ */
+void clear_ctg_cache(void)
+{
+    if (!ctg_book) return;
+    mutex_lock(&ctg_book->lock);
+    if (ctg_book->page_lru.capacity) lru_clear(&ctg_book->page_lru);
+    if (ctg_book->slot_lru.capacity) lru_clear(&ctg_book->slot_lru);
+    mutex_unlock(&ctg_book->lock);
+}
+
+/*
+ * Print stats about the page and slot caches of the engine's book.
+ */
+void print_ctg_cache_stats(void)
+{
+    if (!ctg_book) return;
+    ctg_lru_t* lrus[2] = { &ctg_book->page_lru, &ctg_book->slot_lru };
+    const char* names[2] = { "page", "slot" };
+    for (int i=0; i<2; ++i) {
+        ctg_lru_t* lru = lrus[i];
+        int probes = MAX(lru->hits + lru->misses, 1);
+        printf("info string ctg %s cache entries %d", names[i], lru->capacity);
+        printf(" filled %d (%.2f%%)", lru->size,
+                (float)lru->size / (float)MAX(lru->capacity, 1)*100.);
+        printf(" evictions %d", lru->evictions);
+        printf(" hits %d (%.2f%%)", lru->hits,
+                (float)lru->hits / (float)probes*100.);
+        printf(" misses %d (%.2f%%)", lru->misses,
+                (float)lru->misses / (float)probes*100.);
+        if ((i == 0 && ctg_book->ctg_map.data) ||
+                (i == 1 && ctg_book->cto_map.data)) {
+            printf(" (file is mapped)");
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Read up to |len| bytes at |offset| in one of |book|'s files into |buf|,
+ * and return the number of bytes read. This is safe to call from several
+ * threads at once.
+ */
+static size_t book_file_read(ctg_book_t* book,
+        FILE* file,
+        uint64_t offset,
+        size_t len,
+        uint8_t* buf)
+{
+#ifdef HAS_MMAP
+    (void)book;
+    ssize_t bytes = pread(fileno(file), buf, len, offset);
+    return bytes < 0 ? 0 : (size_t)bytes;
+#else
+    size_t bytes = 0;
+    mutex_lock(&book->lock);
+    if (!fseeko(file, offset, SEEK_SET)) bytes = fread(buf, 1, len, file);
+    mutex_unlock(&book->lock);
+    return bytes;
+#endif
+}
+
+/*
+ * Read the big-endian page index stored in slot |key| of the .cto file.
+ * Returns false if the slot lies outside the file.
+ */
+static bool ctg_read_slot(ctg_book_t* book, uint32_t key, int* page_index)
+{
+    uint64_t offset = 16 + (uint64_t)key*4;
+    uint32_t slot;
+    if (book->cto_map.data) {
+        atomic_add(&book->io_stats.slot_reads, 1);
+        if (offset + 4 > book->cto_map.size) return false;
+        memcpy(&slot, book->cto_map.data + offset, 4);
+        *page_index = (int)my_ntohl(slot);
+        return true;
+    }
+
+    mutex_lock(&book->lock);
+    int node = lru_find(&book->slot_lru, key);
+    if (node >= 0) *page_index = book->slot_cache[node];
+    mutex_unlock(&book->lock);
+    if (node >= 0) return true;
+    atomic_add(&book->io_stats.slot_reads, 1);
+    if (book_file_read(book, book->cto_file,
+                offset, 4, (uint8_t*)&slot) != 4) return false;
+    *page_index = (int)my_ntohl(slot);
+    // Another thread may have cached the slot since we looked.
+    mutex_lock(&book->lock);
+    if (lru_lookup(&book->slot_lru, key) < 0) {
+        node = lru_insert(&book->slot_lru, key);
+        if (node >= 0) book->slot_cache[node] = *page_index;
+    }
+    mutex_unlock(&book->lock);
+    return true;
+}
+
 /*
  * Find the page index associated with a given position |hash|.
  */
-static bool ctg_get_page_index(int hash, int* page_index)
+static bool ctg_get_page_index(ctg_book_t* book, int hash, int* page_index)
 {
     uint32_t key = 0;
-    for (int mask = 1; key <= (uint32_t)page_bounds.high;
+    for (int mask = 1; key <= (uint32_t)book->page_bounds.high;
             mask = (mask << 1) + 1) {
         key = (hash & mask) + mask;
-        if (key >= (uint32_t)page_bounds.low) {
+        if (key >= (uint32_t)book->page_bounds.low) {
             //printf("found entry with key=%d\n", key);
-            fseek(cto_file, 16 + key*4, SEEK_SET);
-            fread(page_index, 4, 1, cto_file);
-            *page_index = my_ntohl((uint32_t)*page_index);
+            if (!ctg_read_slot(book, key, page_index)) continue;
             if (*page_index >= 0) return true;
         }
     }
@@ -305,75 +1002,699 @@ static bool ctg_get_page_index(int hash, int* page_index)
     return false;
 }
 
+/*
+ * Get a pointer to the 4096-byte page with the given index. If the book is
+ * mapped this points directly into the mapping, otherwise the page is read
+ * into |buf|. Returns NULL if the page can't be read.
+ */
+static const uint8_t* ctg_read_page(ctg_book_t* book,
+        int page_index,
+        uint8_t* buf)
+{
+    uint64_t offset = (uint64_t)CTG_PAGE_SIZE*(page_index + 1);
+    if (book->ctg_map.data) {
+        atomic_add(&book->io_stats.page_reads, 1);
+        if (offset + CTG_PAGE_SIZE > book->ctg_map.size) return NULL;
+        return book->ctg_map.data + offset;
+    }
+
+    // The cached copy is copied out rather than referenced, so that a later
+    // eviction can't change the page out from under the caller.
+    mutex_lock(&book->lock);
+    int node = lru_find(&book->page_lru, page_index);
+    if (node >= 0) {
+        memcpy(buf, book->page_cache + (size_t)node*CTG_PAGE_SIZE,
+                CTG_PAGE_SIZE);
+    }
+    mutex_unlock(&book->lock);
+    if (node >= 0) return buf;
+    atomic_add(&book->io_stats.page_reads, 1);
+    if (!book_file_read(book, book->ctg_file,
+                offset, CTG_PAGE_SIZE, buf)) return NULL;
+    mutex_lock(&book->lock);
+    if (lru_lookup(&book->page_lru, page_index) < 0) {
+        node = lru_insert(&book->page_lru, page_index);
+        if (node >= 0) {
+            memcpy(book->page_cache + (size_t)node*CTG_PAGE_SIZE,
+                    buf, CTG_PAGE_SIZE);
+        }
+    }
+    mutex_unlock(&book->lock);
+    return buf;
+}
+
+/*
+ * Make |page| hold the page with the given index, reading it only if it
+ * isn't already loaded. Returns NULL if the page can't be read.
+ */
+static const uint8_t* ctg_load_page(ctg_book_t* book,
+        ctg_page_t* page,
+        int page_index)
+{
+    if (page->data && page->index == page_index) return page->data;
+    page->index = page_index;
+    page->data = ctg_read_page(book, page_index, page->buf);
+    return page->data;
+}
+
+/*
+ * Compare two ctg signatures, ordering first by length and then by contents.
+ */
+static int ctg_signature_cmp(const uint8_t* a, int a_len,
+        const uint8_t* b, int b_len)
+{
+    if (a_len != b_len) return a_len - b_len;
+    return memcmp(a, b, a_len);
+}
+
+/*
+ * Return the offset of the first page entry in |buf|, and the number of
+ * entries in the page.
+ */
+static int ctg_page_entries(const uint8_t* buf, int* num_positions)
+{
+    *num_positions = (buf[0]<<8) + buf[1];
+    //printf("found %d positions\n", *num_positions);
+    return 4;
+}
+
+/*
+ * Given the offset |pos| of a page entry in |buf|, return the length of its
+ * signature, or -1 if the entry would run off the end of the page. This
+ * keeps a corrupt page from walking us off the end of the buffer.
+ */
+static int ctg_entry_signature_length(const uint8_t* buf, int pos)
+{
+    if (pos + 32 >= CTG_PAGE_SIZE) return -1;
+    int entry_size = buf[pos] % 32;
+    if (pos + entry_size + buf[pos+entry_size] + 33 > CTG_PAGE_SIZE) return -1;
+    return entry_size;
+}
+
+/*
+ * Return the offset of the page entry following the one at |pos|.
+ */
+static int ctg_next_entry(const uint8_t* buf, int pos)
+{
+    int entry_size = buf[pos] % 32;
+    return pos + entry_size + buf[pos+entry_size] + 33;
+}
+
+/*
+ * Fill in |entry| from the move list and statistics that start at |pos|, just
+ * after an entry's signature. Annoyingly, most of the fields are 24 bits
+ * long.
+ */
+static void ctg_parse_entry_data(const uint8_t* buf,
+        int pos,
+        ctg_entry_t* entry)
+{
+    int entry_size = buf[pos];
+    int num_bytes = MIN(entry_size - 1, (int)sizeof(entry->moves));
+    for (int j=0; j<num_bytes; ++j) entry->moves[j] = buf[pos+j+1];
+    entry->num_moves = num_bytes/2;
+    pos += entry_size;
+    entry->total = read_24(buf, pos);
+    pos += 3;
+    entry->losses = read_24(buf, pos);
+    pos += 3;
+    entry->wins = read_24(buf, pos);
+    pos += 3;
+    entry->draws = read_24(buf, pos);
+    pos += 3;
+    entry->unknown1 = read_32(buf, pos);
+    pos += 4;
+    entry->avg_rating_games = read_24(buf, pos);
+    pos += 3;
+    entry->avg_rating_score = read_32(buf, pos);
+    pos += 4;
+    entry->perf_rating_games = read_24(buf, pos);
+    pos += 3;
+    entry->perf_rating_score = read_32(buf, pos);
+    pos += 4;
+    entry->recommendation = buf[pos];
+    pos += 1;
+    entry->unknown2 = buf[pos];
+    pos += 1;
+    entry->comment = buf[pos];
+}
+
+/*
+ * Fill in |entry| from the page entry at |pos|.
+ */
+static void ctg_parse_entry(const uint8_t* buf, int pos, ctg_entry_t* entry)
+{
+    ctg_parse_entry_data(buf, pos + buf[pos] % 32, entry);
+}
 
 /*
  * Find and copy out a ctg entry, given its page index and signature.
  */
-static bool ctg_lookup_entry(int page_index,
+static bool ctg_lookup_entry(ctg_book_t* book,
+        ctg_page_t* page,
+        int page_index,
         ctg_signature_t* sig,
         ctg_entry_t* entry)
 {
-    // Pages are a uniform 4096 bytes.
-    uint8_t buf[4096];
-    fseek(ctg_file, 4096*(page_index + 1), SEEK_SET);
-    if (!fread(buf, 1, 4096, ctg_file)) return false;
-    int num_positions = (buf[0]<<8) + buf[1];
-    //printf("found %d positions\n", num_positions);
+    const uint8_t* buf = ctg_load_page(book, page, page_index);
+    if (!buf) return false;
+    int num_positions;
+    int pos = ctg_page_entries(buf, &num_positions);
 
     // Just scan through the list until we find a matching signature.
-    int pos = 4;
-    for (int i=0; i<num_positions; ++i) {
-        int entry_size = buf[pos] % 32;
-        bool equal = true;
-        if (sig->buf_len != entry_size) equal = false;
-        for (int j=0; j<sig->buf_len && equal; ++j) {
-            if (buf[pos+j] != sig->buf[j]) equal = false;
-        }
-        if (!equal) {
-            pos += entry_size + buf[pos+entry_size] + 33;
+    for (int i=0; i<num_positions; ++i, pos = ctg_next_entry(buf, pos)) {
+        int entry_size = ctg_entry_signature_length(buf, pos);
+        if (entry_size < 0) break;
+        if (ctg_signature_cmp(buf+pos, entry_size, sig->buf, sig->buf_len)) {
             continue;
         }
-        // Found it, fill in the entry and return. Annoyingly, most of the
-        // fields are 24 bits long.
-        pos += entry_size;
-        entry_size = buf[pos];
-        for (int j=1; j<entry_size; ++j) entry->moves[j-1] = buf[pos+j];
-        entry->num_moves = (entry_size - 1)/2;
-        pos += entry_size;
-        entry->total = read_24(buf, pos);
-        pos += 3;
-        entry->losses = read_24(buf, pos);
-        pos += 3;
-        entry->wins = read_24(buf, pos);
-        pos += 3;
-        entry->draws = read_24(buf, pos);
-        pos += 3;
-        entry->unknown1 = read_32(buf, pos);
-        pos += 4;
-        entry->avg_rating_games = read_24(buf, pos);
-        pos += 3;
-        entry->avg_rating_score = read_32(buf, pos);
-        pos += 4;
-        entry->perf_rating_games = read_24(buf, pos);
-        pos += 3;
-        entry->perf_rating_score = read_32(buf, pos);
-        pos += 4;
-        entry->recommendation = buf[pos];
-        pos += 1;
-        entry->unknown2 = buf[pos];
-        pos += 1;
-        entry->comment = buf[pos];
+        ctg_parse_entry(buf, pos, entry);
         return true;
     }
     return false;
 }
 
+/*
+ * A single query in a batch lookup. |index| is the query's position in the
+ * caller's arrays, which is lost when queries are sorted by page.
+ */
+typedef struct {
+    ctg_signature_t sig;
+    int page_index;
+    int index;
+} ctg_query_t;
+
+/*
+ * Order queries by page, then by signature, so that each page can be read
+ * once and its entries matched by binary search.
+ */
+static int ctg_query_cmp(const void* a, const void* b)
+{
+    const ctg_query_t* qa = a;
+    const ctg_query_t* qb = b;
+    if (qa->page_index != qb->page_index) {
+        return qa->page_index < qb->page_index ? -1 : 1;
+    }
+    return ctg_signature_cmp(qa->sig.buf, qa->sig.buf_len,
+            qb->sig.buf, qb->sig.buf_len);
+}
+
+/*
+ * Match the entries in page |buf| against queries[first..last), which are
+ * sorted by signature, and copy out every match. Returns the number of
+ * queries matched.
+ */
+static int ctg_match_page(const uint8_t* buf,
+        ctg_query_t* queries,
+        int first,
+        int last,
+        ctg_entry_t* entries,
+        bool* found)
+{
+    int num_found = 0;
+    int num_positions;
+    int pos = ctg_page_entries(buf, &num_positions);
+    for (int i=0; i<num_positions; ++i, pos = ctg_next_entry(buf, pos)) {
+        int entry_size = ctg_entry_signature_length(buf, pos);
+        if (entry_size < 0) break;
+
+        // Binary search for the first query matching this entry.
+        int lo = first, hi = last;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (ctg_signature_cmp(queries[mid].sig.buf,
+                        queries[mid].sig.buf_len,
+                        buf+pos, entry_size) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        // The same position may have been queried more than once.
+        for (; lo<last && !ctg_signature_cmp(queries[lo].sig.buf,
+                    queries[lo].sig.buf_len, buf+pos, entry_size); ++lo) {
+            int index = queries[lo].index;
+            ctg_parse_entry(buf, pos, &entries[index]);
+            found[index] = true;
+            ++num_found;
+        }
+    }
+    return num_found;
+}
+
+/*
+ * Look up a batch of queries whose signatures are already filled in. Each
+ * distinct page is read and scanned exactly once, however many queries land
+ * on it, and a page already held in |page| isn't read again. Repeated
+ * signatures share a single match. |entries| and |found| are indexed by each
+ * query's |index|. Returns the number of queries that were found. Note that
+ * |queries| is reordered.
+ */
+static int ctg_lookup_batch(ctg_book_t* book,
+        ctg_query_t* queries,
+        int num_queries,
+        ctg_entry_t* entries,
+        bool* found,
+        ctg_page_t* page)
+{
+    // Resolve page indices, dropping queries that don't map to any page.
+    int num_paged = 0;
+    for (int i=0; i<num_queries; ++i) {
+        found[queries[i].index] = false;
+        int hash = ctg_signature_to_hash(&queries[i].sig);
+        if (!ctg_get_page_index(book, hash, &queries[i].page_index)) continue;
+        queries[num_paged++] = queries[i];
+    }
+    qsort(queries, num_paged, sizeof(ctg_query_t), ctg_query_cmp);
+
+    // Scan the page we already hold before anything can replace it, then
+    // load each of the remaining pages in turn.
+    int num_found = 0;
+    int held_page = page->data ? page->index : -1;
+    for (int pass=0; pass<2; ++pass) {
+        for (int first=0, last=0; first<num_paged; first=last) {
+            int page_index = queries[first].page_index;
+            for (last=first+1; last<num_paged &&
+                    queries[last].page_index == page_index; ++last) {}
+            if ((page_index == held_page) != (pass == 0)) continue;
+            const uint8_t* buf = ctg_load_page(book, page, page_index);
+            if (!buf) continue;
+            num_found += ctg_match_page(buf, queries, first, last,
+                    entries, found);
+        }
+    }
+    return num_found;
+}
+
+/*
+ * Look up the entries in |book| for each of |num_positions| positions. On
+ * return found[i] indicates whether positions[i] is in the book, and if so its
+ * entry is in entries[i]. Returns the number of positions found.
+ */
+int probe_ctg_entries(ctg_book_t* book,
+        position_t* positions,
+        int num_positions,
+        ctg_entry_t* entries,
+        bool* found)
+{
+    if (num_positions <= 0) return 0;
+    if (book->index.num_records) {
+        int num_found = 0;
+        for (int i=0; i<num_positions; ++i) {
+            found[i] = ctg_index_lookup(book,
+                    positions[i].hash, &entries[i]);
+            if (found[i]) ++num_found;
+        }
+        return num_found;
+    }
+    ctg_query_t* queries = malloc(num_positions * sizeof(ctg_query_t));
+    if (!queries) return 0;
+    ctg_page_t page;
+    page.data = NULL;
+    for (int i=0; i<num_positions; ++i) {
+        position_to_ctg_signature(&positions[i], &queries[i].sig);
+        queries[i].index = i;
+    }
+    int num_found = ctg_lookup_batch(book, queries,
+            num_positions, entries, found, &page);
+    free(queries);
+    return num_found;
+}
+
+/*
+ * Look up a batch of positions in the engine's book, as in
+ * probe_ctg_entries.
+ */
+int get_ctg_entries(position_t* positions,
+        int num_positions,
+        ctg_entry_t* entries,
+        bool* found)
+{
+    if (!ctg_book) return 0;
+    return probe_ctg_entries(ctg_book, positions, num_positions,
+            entries, found);
+}
+
+/*
+ * Big-endian accessors for the index file.
+ */
+static uint32_t index_read_32(const uint8_t* buf)
+{
+    uint32_t x;
+    memcpy(&x, buf, 4);
+    return my_ntohl(x);
+}
+
+static uint64_t index_read_64(const uint8_t* buf)
+{
+    uint64_t x;
+    memcpy(&x, buf, 8);
+    return my_ntohll(x);
+}
+
+static void index_write_32(uint8_t* buf, uint32_t x)
+{
+    x = my_htonl(x);
+    memcpy(buf, &x, 4);
+}
+
+static void index_write_64(uint8_t* buf, uint64_t x)
+{
+    x = my_htonll(x);
+    memcpy(buf, &x, 8);
+}
+
+/*
+ * A fingerprint of the zobrist tables. Keys in an index are only meaningful
+ * if they were generated with the same tables we're using now.
+ */
+static uint64_t ctg_index_check_key(void)
+{
+    return piece_random[WHITE][PAWN][8] ^ piece_random[BLACK][KING][60] ^
+        castle_random[1][1][1] ^ enpassant_random[20];
+}
+
+/*
+ * Read |len| bytes at |offset| in the index file into |buf|, or return a
+ * pointer directly into the mapping if there is one. Returns NULL if the
+ * range isn't in the file.
+ */
+static const uint8_t* ctg_index_read(ctg_book_t* book,
+        uint64_t offset,
+        int len,
+        uint8_t* buf)
+{
+    ctg_index_t* index = &book->index;
+    if (index->map.data) {
+        if (offset + len > index->map.size) return NULL;
+        return index->map.data + offset;
+    }
+    if (book_file_read(book, index->file, offset, len, buf) != (size_t)len) {
+        return NULL;
+    }
+    return buf;
+}
+
+/*
+ * Release the currently loaded index, if any.
+ */
+static void close_ctg_index(ctg_book_t* book)
+{
+    unmap_book_file(&book->index.map);
+    if (book->index.file) fclose(book->index.file);
+    memset(&book->index, 0, sizeof(ctg_index_t));
+}
+
+/*
+ * Open the index file |filename|, if it exists. The index is rejected if it
+ * has the wrong format, was built from a .ctg file of a different size, or
+ * was built with different zobrist keys.
+ */
+static bool load_ctg_index(ctg_book_t* book,
+        char* filename,
+        uint64_t ctg_size)
+{
+    ctg_index_t* ctg_index = &book->index;
+    close_ctg_index(book);
+    ctg_index->file = fopen(filename, "rb");
+    if (!ctg_index->file) return false;
+    uint8_t header[CTG_INDEX_HEADER_SIZE];
+    if (fread(header, 1, CTG_INDEX_HEADER_SIZE, ctg_index->file) !=
+            CTG_INDEX_HEADER_SIZE ||
+            memcmp(header, CTG_INDEX_MAGIC, 8) ||
+            index_read_32(header+8) != CTG_INDEX_VERSION ||
+            index_read_32(header+12) != CTG_INDEX_RECORD_SIZE ||
+            index_read_64(header+40) != ctg_size ||
+            index_read_64(header+48) != ctg_index_check_key()) {
+        printf("info string Ignoring stale or invalid book index %s\n",
+                filename);
+        close_ctg_index(book);
+        return false;
+    }
+    ctg_index->num_records = index_read_64(header+16);
+    ctg_index->data_offset = index_read_64(header+24);
+    ctg_index->records_offset = index_read_64(header+32);
+    if (!ctg_index->num_records) {
+        close_ctg_index(book);
+        return false;
+    }
+    map_book_file(ctg_index->file, &ctg_index->map, true);
+    return true;
+}
+
+/*
+ * Find the entry for the position with zobrist key |key| in the index.
+ */
+static bool ctg_index_lookup(ctg_book_t* book,
+        hashkey_t key,
+        ctg_entry_t* entry)
+{
+    ctg_index_t* ctg_index = &book->index;
+    uint8_t buf[CTG_MAX_ENTRY_DATA];
+    const uint8_t* record;
+    uint64_t lo = 0, hi = ctg_index->num_records;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        record = ctg_index_read(book, ctg_index->records_offset +
+                mid*CTG_INDEX_RECORD_SIZE, CTG_INDEX_RECORD_SIZE, buf);
+        if (!record) return false;
+        hashkey_t mid_key = index_read_64(record);
+        if (mid_key < key) lo = mid + 1;
+        else if (mid_key > key) hi = mid;
+        else {
+            uint64_t offset = ctg_index->data_offset + index_read_32(record+8);
+            // The data may be shorter than the buffer if it's at the end of
+            // the data section, so read just the length byte first.
+            const uint8_t* data = ctg_index_read(book, offset, 1, buf);
+            if (!data) return false;
+            data = ctg_index_read(book, offset, data[0] + 33, buf);
+            if (!data) return false;
+            ctg_parse_entry_data(data, 0, entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    hashkey_t key;
+    uint32_t offset;
+} ctg_index_record_t;
+
+static int ctg_index_record_cmp(const void* a, const void* b)
+{
+    hashkey_t ka = ((const ctg_index_record_t*)a)->key;
+    hashkey_t kb = ((const ctg_index_record_t*)b)->key;
+    return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+/*
+ * Walk every page of the ctg book |filename| in order and write an index
+ * file alongside it, named with a .cti extension, that init_ctg_book will
+ * pick up. Each entry's signature is decoded back into the positions that
+ * produce it, and the entry is filed under each of their zobrist keys.
+ * Requires the zobrist tables to be initialized.
+ */
+bool build_ctg_index(char* filename)
+{
+    int name_len = strlen(filename);
+    if (name_len < 4 || strcmp(filename + name_len - 4, ".ctg")) {
+        printf("%s is not a .ctg file\n", filename);
+        return false;
+    }
+    char index_name[1024];
+    strncpy(index_name, filename, sizeof(index_name) - 1);
+    index_name[sizeof(index_name) - 1] = '\0';
+    index_name[name_len-1] = 'i';
+
+    FILE* book = fopen(filename, "rb");
+    if (!book) {
+        printf("Couldn't open %s\n", filename);
+        return false;
+    }
+    FILE* out = fopen(index_name, "wb");
+    if (!out) {
+        printf("Couldn't create %s\n", index_name);
+        fclose(book);
+        return false;
+    }
+
+    // The header is written last, once we know what goes in it.
+    uint8_t header[CTG_INDEX_HEADER_SIZE];
+    memset(header, 0, CTG_INDEX_HEADER_SIZE);
+    fwrite(header, 1, CTG_INDEX_HEADER_SIZE, out);
+
+    uint64_t num_records = 0, max_records = 1<<16;
+    ctg_index_record_t* records = malloc(max_records * sizeof(*records));
+    uint64_t data_size = 0;
+    int num_pages = 0, num_entries = 0, num_undecodable = 0;
+    position_t positions[4];
+    uint8_t buf[CTG_PAGE_SIZE];
+    fseek(book, CTG_PAGE_SIZE, SEEK_SET);
+    while (records &&
+            fread(buf, 1, CTG_PAGE_SIZE, book) == CTG_PAGE_SIZE) {
+        ++num_pages;
+        int num_positions;
+        int pos = ctg_page_entries(buf, &num_positions);
+        for (int i=0; i<num_positions; ++i, pos = ctg_next_entry(buf, pos)) {
+            int sig_len = ctg_entry_signature_length(buf, pos);
+            if (sig_len < 0) break;
+            ++num_entries;
+            int n = ctg_signature_to_positions(buf+pos, positions);
+            if (!n) {
+                ++num_undecodable;
+                continue;
+            }
+            int data_len = buf[pos+sig_len] + 33;
+            fwrite(buf+pos+sig_len, 1, data_len, out);
+            for (int j=0; j<n; ++j) {
+                if (num_records == max_records) {
+                    max_records *= 2;
+                    records = realloc(records, max_records * sizeof(*records));
+                    if (!records) break;
+                }
+                records[num_records].key = positions[j].hash;
+                records[num_records++].offset = data_size;
+            }
+            if (!records) break;
+            data_size += data_len;
+        }
+        if (num_pages % 10000 == 0) {
+            printf("%d pages, %d entries, %"PRIu64" keys\n",
+                    num_pages, num_entries, num_records);
+        }
+    }
+    uint64_t ctg_size = book_file_size(book);
+    fclose(book);
+    if (!records || data_size > UINT32_MAX) {
+        printf("Book is too large to index\n");
+        free(records);
+        fclose(out);
+        remove(index_name);
+        return false;
+    }
+
+    // Sort the keys, and drop any duplicates. Distinct book entries with
+    // the same key would need a hash collision, so keep the first.
+    qsort(records, num_records, sizeof(*records), ctg_index_record_cmp);
+    uint64_t num_unique = 0;
+    for (uint64_t i=0; i<num_records; ++i) {
+        if (num_unique && records[num_unique-1].key == records[i].key) {
+            continue;
+        }
+        records[num_unique++] = records[i];
+    }
+    for (uint64_t i=0; i<num_unique; ++i) {
+        uint8_t record[CTG_INDEX_RECORD_SIZE];
+        index_write_64(record, records[i].key);
+        index_write_32(record+8, records[i].offset);
+        fwrite(record, 1, CTG_INDEX_RECORD_SIZE, out);
+    }
+    free(records);
+
+    memcpy(header, CTG_INDEX_MAGIC, 8);
+    index_write_32(header+8, CTG_INDEX_VERSION);
+    index_write_32(header+12, CTG_INDEX_RECORD_SIZE);
+    index_write_64(header+16, num_unique);
+    index_write_64(header+24, CTG_INDEX_HEADER_SIZE);
+    index_write_64(header+32, CTG_INDEX_HEADER_SIZE + data_size);
+    index_write_64(header+40, ctg_size);
+    index_write_64(header+48, ctg_index_check_key());
+    fseek(out, 0, SEEK_SET);
+    fwrite(header, 1, CTG_INDEX_HEADER_SIZE, out);
+    bool success = !ferror(out);
+    success = !fclose(out) && success;
+    printf("Indexed %d pages, %d entries (%d undecodable), "
+            "%"PRIu64" keys into %s\n",
+            num_pages, num_entries, num_undecodable, num_unique, index_name);
+    return success;
+}
+
+/*
+ * Write the entry at |pos| in page |buf|, as found in |book_pos|, to |out|
+ * as a single json object on its own line.
+ */
+static void dump_ctg_entry(FILE* out,
+        position_t* book_pos,
+        const uint8_t* buf,
+        int pos)
+{
+    ctg_entry_t entry;
+    ctg_parse_entry(buf, pos, &entry);
+    char fen[256], move_str[7];
+    position_to_fen_str(book_pos, fen);
+    fprintf(out, "{\"fen\": \"%s\", \"moves\": [", fen);
+    bool first = true;
+    for (int i=0; i<2*entry.num_moves; i += 2) {
+        move_t move = byte_to_move(book_pos, entry.moves[i]);
+        if (move == NO_MOVE) continue;
+        move_to_coord_str(move, move_str);
+        fprintf(out, "%s{\"move\": \"%s\", \"note\": %d}",
+                first ? "" : ", ", move_str, entry.moves[i+1]);
+        first = false;
+    }
+    fprintf(out, "], \"total\": %d, \"wins\": %d, \"draws\": %d, "
+            "\"losses\": %d, \"rec\": %d, \"avg_games\": %d, "
+            "\"avg_score\": %d, \"perf_games\": %d, \"perf_score\": %d, "
+            "\"comment\": %d}\n",
+            entry.total, entry.wins, entry.draws, entry.losses,
+            entry.recommendation, entry.avg_rating_games,
+            entry.avg_rating_score, entry.perf_rating_games,
+            entry.perf_rating_score, entry.comment);
+}
+
+/*
+ * Export every position in the ctg book |filename| to |out| as json lines,
+ * one object per position. Pages are read in file order, one at a time, so
+ * this is much faster than probing positions individually and runs in
+ * constant memory however large the book is. A signature that several
+ * positions share, which happens when a position without castling rights
+ * can be mirrored, produces a line for each of them. Requires the zobrist
+ * tables to be initialized.
+ */
+bool dump_ctg_book(char* filename, FILE* out)
+{
+    FILE* book = fopen(filename, "rb");
+    if (!book) {
+        printf("Couldn't open %s\n", filename);
+        return false;
+    }
+    int num_pages = 0, num_entries = 0, num_undecodable = 0;
+    uint64_t num_positions_written = 0;
+    position_t positions[4];
+    uint8_t buf[CTG_PAGE_SIZE];
+    fseek(book, CTG_PAGE_SIZE, SEEK_SET);
+    while (fread(buf, 1, CTG_PAGE_SIZE, book) == CTG_PAGE_SIZE) {
+        ++num_pages;
+        int num_positions;
+        int pos = ctg_page_entries(buf, &num_positions);
+        for (int i=0; i<num_positions; ++i, pos = ctg_next_entry(buf, pos)) {
+            if (ctg_entry_signature_length(buf, pos) < 0) break;
+            ++num_entries;
+            int n = ctg_signature_to_positions(buf+pos, positions);
+            if (!n) ++num_undecodable;
+            for (int j=0; j<n; ++j) {
+                dump_ctg_entry(out, &positions[j], buf, pos);
+            }
+            num_positions_written += n;
+        }
+    }
+    fclose(book);
+    bool success = !ferror(out);
+    if (out != stdout) {
+        printf("Dumped %d pages, %d entries (%d undecodable), "
+                "%"PRIu64" positions\n",
+                num_pages, num_entries, num_undecodable,
+                num_positions_written);
+    }
+    return success;
+}
+
 /*
  * Convert a ctg-format move to native format. The ctg move format seems
  * really bizarre; maybe there's some simpler formulation. The ctg move
  * indicates the piece type, the index of the piece to be moved (counting
  * from A1 to H8 by ranks), and the delta x and delta y of the move.
- * We just look these values up in big tables.
+ * We just look these values up in big tables. Returns NO_MOVE if the byte
+ * doesn't describe a legal move in |pos|, so a damaged entry can't take
+ * down the caller.
  */
 static move_t byte_to_move(position_t* pos, uint8_t byte)
 {
@@ -464,7 +1785,6 @@ static move_t byte_to_move(position_t* pos, uint8_t byte)
 
     // Look up piece type. Note: positions are always white to move.
     piece_t pc = NONE;
-    char glyph = piece_code[byte];
     switch (piece_code[byte]) {
         case 'P': pc = WP; break;
         case 'N': pc = WN; break;
@@ -472,7 +1792,7 @@ static move_t byte_to_move(position_t* pos, uint8_t byte)
         case 'R': pc = WR; break;
         case 'Q': pc = WQ; break;
         case 'K': pc = WK; break;
-        default: printf("%d -> (%c)\n", byte, glyph); assert(false);
+        default: return NO_MOVE;
     }
 
     // Find the piece.
@@ -493,7 +1813,7 @@ static move_t byte_to_move(position_t* pos, uint8_t byte)
             }
         }
     }
-    assert(found);
+    if (!found) return NO_MOVE;
 
     // Normalize rank and file values.
     file_to = file_from - left[byte];
@@ -529,32 +1849,25 @@ static move_t squares_to_move(position_t* pos, square_t from, square_t to)
                 (get_move_promote(move) == NONE ||
                  get_move_promote(move) == QUEEN)) return move;
     }
-    assert(false);
     return NO_MOVE;
 }
 
 /*
- * Assign a weight to the given move, which indicates its relative
- * probability of being selected.
+ * Assign a weight to |move|, which indicates its relative probability of
+ * being selected, given the book entry |child| for the position it leads to.
+ * The move and its statistics are recorded in |bm|.
  */
-static int64_t move_weight(position_t* pos,
-        move_t move,
+static void move_weight(move_t move,
         uint8_t annotation,
-        bool* recommended)
+        ctg_entry_t* child,
+        ctg_book_move_t* bm)
 {
-    undo_info_t undo;
-    do_move(pos, move, &undo);
-    ctg_entry_t entry;
-    bool success = ctg_get_entry(pos, &entry);
-    undo_move(pos, move, &undo);
-    if (!success) return 0;
-
-    *recommended = false;
-    int64_t half_points = 2*entry.wins + entry.draws;
-    int64_t games = entry.wins + entry.draws + entry.losses;
+    bool recommended = false;
+    int64_t half_points = 2*child->wins + child->draws;
+    int64_t games = child->wins + child->draws + child->losses;
     int64_t weight = (games < 1) ? 0 : (half_points * 10000) / games;
-    if (entry.recommendation == 64) weight = 0;
-    if (entry.recommendation == 128) *recommended = true;
+    if (child->recommendation == 64) weight = 0;
+    if (child->recommendation == 128) recommended = true;
 
     // Adjust weights based on move annotations. Note that moves can be both
     // marked as recommended and annotated with a '?'. Since moves like this
@@ -562,53 +1875,104 @@ static int64_t move_weight(position_t* pos,
     // order to give results consistent with expectations.
     switch (annotation) {
         case 0x01: weight *=  8; break;                         //  !
-        case 0x02: weight  =  0; *recommended = false; break;   //  ?
+        case 0x02: weight  =  0; recommended = false; break;    //  ?
         case 0x03: weight *= 32; break;                         // !!
-        case 0x04: weight  =  0; *recommended = false; break;   // ??
-        case 0x05: weight /=  2; *recommended = false; break;   // !?
-        case 0x06: weight /=  8; *recommended = false; break;   // ?!
+        case 0x04: weight  =  0; recommended = false; break;    // ??
+        case 0x05: weight /=  2; recommended = false; break;    // !?
+        case 0x06: weight /=  8; recommended = false; break;    // ?!
         case 0x08: weight = INT32_MAX; break;                   // Only move
         case 0x16: break;                                       // Zugzwang
         default: break;
     }
 
-    static char move_str[7];
-    move_to_coord_str(move, move_str);
-    // printf("info string book move ");
-    // print_coord_move(move);
-    // printf("weight %6"PRIu64"\n", weight);
-    printf("{\"move\": \"%s\" ,\"weight\": %6"PRIu64", \"wins\":%6d,\"draws\":%6d, \"losses\":%6d, \"rec\":%3d, "
-           "\"note\":%2d, \"avg_games\":%6d,\"avg_score\":%9d, "
-           "\"perf_games\":%6d, \"perf_score\":%9d}\n",
-           move_str, weight, entry.wins, entry.draws, entry.losses, entry.recommendation,
-           annotation, entry.avg_rating_games, entry.avg_rating_score,
-           entry.perf_rating_games, entry.perf_rating_score);
-    return weight;
+    bm->move = move;
+    bm->weight = weight;
+    bm->recommended = recommended;
+    bm->annotation = annotation;
+    bm->wins = child->wins;
+    bm->draws = child->draws;
+    bm->losses = child->losses;
+    bm->recommendation = child->recommendation;
+    bm->avg_rating_games = child->avg_rating_games;
+    bm->avg_rating_score = child->avg_rating_score;
+    bm->perf_rating_games = child->perf_rating_games;
+    bm->perf_rating_score = child->perf_rating_score;
+}
+
+/*
+ * Decode the moves stored in |entry|, look up the positions they lead to,
+ * and weigh each of them. Moves whose resulting positions aren't in the
+ * book can never be chosen, so they're left out. |page| holds the page
+ * |entry| came from, which often also holds some of the children.
+ */
+static int ctg_collect_moves(ctg_book_t* book,
+        position_t* pos,
+        ctg_entry_t* entry,
+        ctg_page_t* page,
+        ctg_book_move_t* book_moves)
+{
+    move_t moves[MAX_CTG_BOOK_MOVES];
+    uint8_t annotations[MAX_CTG_BOOK_MOVES];
+    int num_candidates = 0;
+    for (int i=0; i<2*entry->num_moves &&
+            num_candidates<MAX_CTG_BOOK_MOVES; i += 2) {
+        move_t m = byte_to_move(pos, entry->moves[i]);
+        if (m == NO_MOVE) continue;
+        moves[num_candidates] = m;
+        annotations[num_candidates++] = entry->moves[i+1];
+    }
+
+    ctg_entry_t children[MAX_CTG_BOOK_MOVES];
+    bool found[MAX_CTG_BOOK_MOVES];
+    undo_info_t undo;
+    if (book->batch_child_lookups && !book->index.num_records) {
+        ctg_query_t queries[MAX_CTG_BOOK_MOVES];
+        for (int i=0; i<num_candidates; ++i) {
+            do_move(pos, moves[i], &undo);
+            position_to_ctg_signature(pos, &queries[i].sig);
+            undo_move(pos, moves[i], &undo);
+            queries[i].index = i;
+        }
+        ctg_lookup_batch(book, queries, num_candidates,
+                children, found, page);
+    } else {
+        for (int i=0; i<num_candidates; ++i) {
+            ctg_page_t child_page;
+            child_page.data = NULL;
+            do_move(pos, moves[i], &undo);
+            found[i] = ctg_get_entry(book, pos, &children[i], &child_page);
+            undo_move(pos, moves[i], &undo);
+        }
+    }
+
+    int num_moves = 0;
+    for (int i=0; i<num_candidates; ++i) {
+        if (!found[i]) continue;
+        move_weight(moves[i], annotations[i], &children[i],
+                &book_moves[num_moves++]);
+    }
+    return num_moves;
 }
 
 /*
  * Do the actual work of choosing amongst all book moves according to weight.
  */
-static bool ctg_pick_move(position_t* pos, ctg_entry_t* entry, move_t* move)
+static bool ctg_pick_move(ctg_book_move_t* book_moves,
+        int num_moves,
+        move_t* move)
 {
-    move_t moves[50];
-    int64_t weights[50];
-    bool recommended[50];
+    int64_t weights[MAX_CTG_BOOK_MOVES];
     int64_t total_weight = 0;
     bool have_recommendations = false;
-    for (int i=0; i<2*entry->num_moves; i += 2) {
-        uint8_t byte = entry->moves[i];
-        move_t m = byte_to_move(pos, byte);
-        moves[i/2] = m;
-        weights[i/2] = move_weight(pos, m, entry->moves[i+1], &recommended[i/2]);
-        if (recommended[i/2]) have_recommendations = true;
-        if (move == NO_MOVE) break;
+    for (int i=0; i<num_moves; ++i) {
+        if (book_moves[i].recommended) have_recommendations = true;
     }
 
     // Do a prefix sum on the weights to facilitate a random choice. If there are recommended
     // moves, ensure that we don't pick a move that wasn't recommended.
-    for (int i=0; i<entry->num_moves; ++i) {
-        if (have_recommendations && !recommended[i]) weights[i] = 0;
+    for (int i=0; i<num_moves; ++i) {
+        weights[i] = book_moves[i].weight;
+        if (have_recommendations && !book_moves[i].recommended) weights[i] = 0;
         total_weight += weights[i];
         weights[i] = total_weight;
     }
@@ -619,25 +1983,33 @@ static bool ctg_pick_move(position_t* pos, ctg_entry_t* entry, move_t* move)
     int64_t choice = random_64() % total_weight;
     int64_t i;
     for (i=0; choice >= weights[i]; ++i) {}
-    if (i >= entry->num_moves) {
+    if (i >= num_moves) {
         printf("i: %"PRIu64"\nchoice: %"PRIu64"\ntotal_weight: %"
                 PRIu64"\nnum_moves: %d\n",
-                i, choice, total_weight, entry->num_moves);
+                i, choice, total_weight, num_moves);
         assert(false);
     }
-    *move = moves[i];
+    *move = book_moves[i].move;
     return true;
 }
 
 /*
  * Get the ctg entry associated with the given position.
  */
-static bool ctg_get_entry(position_t* pos, ctg_entry_t* entry)
+static bool ctg_get_entry(ctg_book_t* book,
+        position_t* pos,
+        ctg_entry_t* entry,
+        ctg_page_t* page)
 {
+    if (book->index.num_records) {
+        return ctg_index_lookup(book, pos->hash, entry);
+    }
     ctg_signature_t sig;
     position_to_ctg_signature(pos, &sig);
     int page_index, hash = ctg_signature_to_hash(&sig);
-    if (!ctg_get_page_index(hash, &page_index)) return false;
-    if (!ctg_lookup_entry(page_index, &sig, entry)) return false;
+    if (!ctg_get_page_index(book, hash, &page_index)) return false;
+    if (!ctg_lookup_entry(book, page, page_index, &sig, entry)) {
+        return false;
+    }
     return true;
 }
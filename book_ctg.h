@@ -0,0 +1,58 @@
+#ifndef BOOK_CTG_H
+#define BOOK_CTG_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_CTG_BOOK_MOVES  50
+
+/*
+ * A move found in a ctg book, along with the statistics stored for the
+ * position it leads to and the selection weight we derived from them.
+ */
+typedef struct {
+    move_t move;
+    int64_t weight;
+    bool recommended;
+    int annotation;
+    int wins;
+    int draws;
+    int losses;
+    int recommendation;
+    int avg_rating_games;
+    int avg_rating_score;
+    int perf_rating_games;
+    int perf_rating_score;
+} ctg_book_move_t;
+
+/*
+ * The raw contents of a ctg book entry. Moves are stored as pairs of bytes,
+ * an encoded move followed by its annotation.
+ */
+typedef struct {
+    int num_moves;
+    uint8_t moves[100];
+    int total;
+    int wins;
+    int losses;
+    int draws;
+    int unknown1;
+    int avg_rating_games;
+    int avg_rating_score;
+    int perf_rating_games;
+    int perf_rating_score;
+    int recommendation;
+    int unknown2;
+    int comment;
+} ctg_entry_t;
+
+/*
+ * An open ctg book. Once opened, a book can be probed from any number of
+ * threads at once; its contents are defined in book_ctg.c.
+ */
+typedef struct ctg_book_s ctg_book_t;
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif // BOOK_CTG_H
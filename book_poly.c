@@ -1,5 +1,9 @@
-
 #include "daydreamer.h"
+#include <string.h>
+#ifdef HAS_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 
 typedef struct {
@@ -13,10 +17,79 @@ static move_t book_move_to_move(position_t* pos, uint16_t book_move);
 static void read_book_entry(int index, book_entry_t* entry);
 static int find_book_key(uint64_t target_key);
 static uint64_t book_hash(position_t* pos);
+static uint16_t move_to_book_move(position_t* pos, move_t move);
 
 static FILE* book = NULL;
 static int num_entries;
 
+// The raw big-endian records of the current book, if the whole file is
+// mapped or preloaded into memory. Otherwise |book_data| is NULL and
+// records are read through stdio.
+static const uint8_t* book_data = NULL;
+static size_t book_data_size = 0;
+static bool book_preloaded = false;
+
+// Books no larger than this are read into memory when they're loaded.
+static int book_preload_bytes = 0;
+static char book_filename[1024] = "";
+
+/*
+ * Release the current book, if any.
+ */
+static void close_poly_book(void)
+{
+    if (book_preloaded) free((void*)book_data);
+#ifdef HAS_MMAP
+    else if (book_data) munmap((void*)book_data, book_data_size);
+#endif
+    book_data = NULL;
+    book_data_size = 0;
+    book_preloaded = false;
+    if (book) fclose(book);
+    book = NULL;
+    num_entries = 0;
+}
+
+/*
+ * Open the Polyglot book |filename|. If it's no larger than |preload_bytes|,
+ * read the whole thing into memory. Otherwise map it if |map| is set and the
+ * platform supports it, and fall back to stdio if it doesn't.
+ */
+static bool open_poly_book(char* filename, int preload_bytes, bool map)
+{
+    close_poly_book();
+    if (!(book = fopen(filename, "rb"))) return false;
+    fseek(book, 0, SEEK_END);
+    size_t size = ftell(book);
+    num_entries = size / 16;
+    if (!num_entries) return true;
+
+    if (size <= (size_t)preload_bytes) {
+        uint8_t* data = malloc(size);
+        fseek(book, 0, SEEK_SET);
+        if (data && fread(data, 1, size, book) == size) {
+            book_data = data;
+            book_data_size = size;
+            book_preloaded = true;
+            return true;
+        }
+        free(data);
+    }
+#ifdef HAS_MMAP
+    if (map) {
+        void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(book), 0);
+        if (data != MAP_FAILED) {
+            madvise(data, size, MADV_RANDOM);
+            book_data = data;
+            book_data_size = size;
+        }
+    }
+#else
+    (void)map;
+#endif
+    return true;
+}
+
 /*
  * Load the given book file, in Polyglot format.
  */
@@ -24,16 +97,28 @@ bool init_poly_book(char* filename)
 {
     assert(sizeof(book_entry_t) == 16);
     srandom_32(time(NULL));
-    if (book) fclose(book);
-    if (!(book = fopen(filename, "r"))) {
-        num_entries = 0;
+    strncpy(book_filename, filename, sizeof(book_filename) - 1);
+    if (!open_poly_book(book_filename, book_preload_bytes, true)) {
+        book_filename[0] = '\0';
         return false;
     }
-    fseek(book, 0, SEEK_END);
-    num_entries = ftell(book) / 16;
     return true;
 }
 
+/*
+ * Set the size of the largest book that is read entirely into memory rather
+ * than mapped. Small books don't gain much from the page cache, and keeping
+ * them in ram avoids any page faults while probing. The current book is
+ * reloaded if the setting affects it.
+ */
+void set_poly_book_preload(int max_bytes)
+{
+    book_preload_bytes = MAX(max_bytes, 0);
+    if (book && book_filename[0]) {
+        open_poly_book(book_filename, book_preload_bytes, true);
+    }
+}
+
 /*
  * Pick a move out of the current book. If |pos| is not in the book, return
  * NO_MOVE. If more than one alternative exists, choose randomly among all
@@ -52,8 +137,7 @@ move_t get_poly_book_move(position_t* pos)
     book_entry_t entry;
     // Read all book entries with the correct key. They're all stored
     // contiguously, so just scan through as long as the key matches.
-    while (true) {
-        assert(offset+index < num_entries);
+    while (offset+index < num_entries && index < 255) {
         read_book_entry(offset+index, &entry);
         if (entry.key != key) break;
         moves[index] = book_move_to_move(pos, entry.move);
@@ -63,7 +147,7 @@ move_t get_poly_book_move(position_t* pos)
         weights[index++] = total_weight + entry.weight;
         total_weight += entry.weight;
     }
-    if (index == 0) return NO_MOVE;
+    if (index == 0 || total_weight == 0) return NO_MOVE;
 
     // Choose randomly amonst the weighted options.
     uint16_t choice = random_32() % total_weight;
@@ -73,6 +157,22 @@ move_t get_poly_book_move(position_t* pos)
     return moves[i];
 }
 
+/*
+ * Return the key of the |index|'th entry in the current book. When the book
+ * is in memory, this only touches the key itself.
+ */
+static uint64_t book_entry_key(int index)
+{
+    if (book_data) {
+        uint64_t key;
+        memcpy(&key, book_data + (size_t)index*16, 8);
+        return my_ntohll(key);
+    }
+    book_entry_t entry;
+    read_book_entry(index, &entry);
+    return entry.key;
+}
+
 /*
  * Locate the book entry with the given key. Returns -1 if the key does not
  * exist. Note that the lowest entry with the given key should be returned,
@@ -80,20 +180,18 @@ move_t get_poly_book_move(position_t* pos)
  */
 int find_book_key(uint64_t target_key)
 {
-    int high = num_entries, low = -1, mid = 0;
-    book_entry_t entry;
+    int high = num_entries, low = 0, mid = 0;
 
     // Since the positions are all in sorted order, just binary search to find
     // the target key.
     while (low < high) {
-        mid = (high + low) / 2;
-        read_book_entry(mid, &entry);
-        if (target_key <= entry.key) high = mid;
+        mid = low + (high - low) / 2;
+        if (target_key <= book_entry_key(mid)) high = mid;
         else low = mid + 1;
     }
-    read_book_entry(low, &entry);
     assert(high == low);
-    return entry.key == target_key ? low : -1;
+    if (low >= num_entries) return -1;
+    return book_entry_key(low) == target_key ? low : -1;
 }
 
 /*
@@ -103,8 +201,12 @@ int find_book_key(uint64_t target_key)
  */
 void read_book_entry(int index, book_entry_t* entry)
 {
-    fseek(book, index * 16, SEEK_SET);
-    fread(entry, 16, 1, book);
+    if (book_data) {
+        memcpy(entry, book_data + (size_t)index*16, 16);
+    } else {
+        fseek(book, (long)index * 16, SEEK_SET);
+        if (fread(entry, 16, 1, book) != 1) memset(entry, 0, 16);
+    }
     entry->key = my_ntohll(entry->key);
     entry->move = my_ntohs(entry->move);
     entry->weight = my_ntohs(entry->weight);
@@ -460,15 +562,14 @@ void test_book(char* filename, position_t* pos)
     int index = 0;
     book_entry_t entry;
     printf("\n\nBook moves\n");
-    while (true) {
-        assert(offset+index < num_entries);
+    while (offset+index < num_entries && index < 255) {
         read_book_entry(offset+index, &entry);
         if (entry.key != key) break;
         moves[index] = entry.move;
         weights[index++] = total_weight + entry.weight;
         total_weight += entry.weight;
     }
-    if (index == 0) return;
+    if (index == 0 || total_weight == 0) return;
     for (int i=0; i<index; ++i) {
         print_coord_move(book_move_to_move(pos, moves[i]));
         printf(" %d\n", weights[i]);
@@ -482,3 +583,314 @@ void test_book(char* filename, position_t* pos)
         printf("\n");
     }
 }
+
+/*
+ * Time lookups of |num_probes| keys in the Polyglot book |filename| with
+ * each of the ways a book can be accessed: seeking and reading through
+ * stdio, binary searching a mapping of the file, and binary searching a
+ * copy preloaded into memory. Half of the keys are taken from the book and
+ * half are random, so both hits and misses are measured. Each probe finds
+ * the first matching entry and then scans all of the entries for its key,
+ * as get_poly_book_move does. Called from the uci extension command
+ * "polybench". The previously loaded book is restored afterwards.
+ */
+void poly_book_bench(char* filename, int num_probes)
+{
+    char previous[1024];
+    strcpy(previous, book_filename);
+    if (!open_poly_book(filename, 0, false) || !num_entries) {
+        printf("Couldn't load book %s\n", filename);
+        if (previous[0]) open_poly_book(previous, book_preload_bytes, true);
+        return;
+    }
+    num_probes = MAX(num_probes, 1);
+    uint64_t* keys = malloc(num_probes * sizeof(uint64_t));
+    for (int i=0; i<num_probes; ++i) {
+        keys[i] = i % 2 ? (uint64_t)random_64() :
+            book_entry_key((uint32_t)random_32() % num_entries);
+    }
+
+    const char* names[3] = { "stdio", "mmap", "preload" };
+    double base_rate = 0;
+    for (int access=0; access<3; ++access) {
+        open_poly_book(filename, access == 2 ? INT_MAX : 0, access == 1);
+        if (access && !book_data) {
+            printf("%s: not supported\n", names[access]);
+            continue;
+        }
+        milli_timer_t timer;
+        init_timer(&timer);
+        start_timer(&timer);
+        int hits = 0, moves = 0;
+        for (int i=0; i<num_probes; ++i) {
+            int offset = find_book_key(keys[i]);
+            if (offset < 0) continue;
+            ++hits;
+            book_entry_t entry;
+            for (; offset < num_entries; ++offset, ++moves) {
+                read_book_entry(offset, &entry);
+                if (entry.key != keys[i]) break;
+            }
+        }
+        int elapsed = MAX(stop_timer(&timer), 1);
+        double rate = num_probes * 1000.0 / elapsed;
+        if (access == 0) base_rate = rate;
+        printf("%s: %d probes, %d hits, %d moves, %d ms, "
+                "%.0f probes/sec (%.2fx)\n",
+                names[access], num_probes, hits, moves, elapsed, rate,
+                rate / MAX(base_rate, 1));
+    }
+    free(keys);
+    close_poly_book();
+    if (previous[0]) open_poly_book(previous, book_preload_bytes, true);
+}
+
+/*
+ * Convert a move to polyglot format. This is the inverse of
+ * book_move_to_move: castles are encoded as the king capturing its own
+ * rook, and promotions count up from knight.
+ */
+static uint16_t move_to_book_move(position_t* pos, move_t move)
+{
+    square_t from = get_move_from(move);
+    square_t to = get_move_to(move);
+    if (is_move_castle_short(move)) {
+        to = king_rook_home + A8*pos->side_to_move;
+    } else if (is_move_castle_long(move)) {
+        to = queen_rook_home + A8*pos->side_to_move;
+    }
+    uint16_t book_move = square_file(to) | (square_rank(to) << 3) |
+        (square_file(from) << 6) | (square_rank(from) << 9);
+    piece_type_t promote_type = get_move_promote(move);
+    if (promote_type) book_move |= (promote_type - 1) << 12;
+    return book_move;
+}
+
+/*
+ * The score accumulated for playing a move from a position while building a
+ * book. A zero score marks an empty slot in the aggregation table.
+ */
+typedef struct {
+    uint64_t key;
+    uint32_t score;
+    uint16_t move;
+} book_count_t;
+
+static int book_count_cmp(const void* a, const void* b)
+{
+    const book_count_t* ca = a;
+    const book_count_t* cb = b;
+    if (ca->key != cb->key) return ca->key < cb->key ? -1 : 1;
+    return (int)ca->move - (int)cb->move;
+}
+
+/*
+ * Sort the occupied slots of |table| and write them to a new temporary run
+ * file, which is added to |runs|. The table is emptied. Returns false if
+ * the run can't be written.
+ */
+static bool spill_book_counts(book_count_t* table,
+        int capacity,
+        FILE*** runs,
+        int* num_runs)
+{
+    int count = 0;
+    for (int i=0; i<capacity; ++i) {
+        if (table[i].score) table[count++] = table[i];
+    }
+    qsort(table, count, sizeof(book_count_t), book_count_cmp);
+    FILE** grown = realloc(*runs, (*num_runs + 1) * sizeof(FILE*));
+    if (!grown) return false;
+    *runs = grown;
+    FILE* run = tmpfile();
+    if (!run) return false;
+    (*runs)[(*num_runs)++] = run;
+    bool success = fwrite(table, sizeof(book_count_t), count, run) ==
+        (size_t)count;
+    memset(table, 0, (size_t)capacity * sizeof(*table));
+    rewind(run);
+    return success;
+}
+
+/*
+ * Write out the moves collected for one position, strongest first. Weights
+ * are 16 bits in the polyglot format, so if any move's score doesn't fit,
+ * the position's scores are scaled down together to keep their ratios.
+ */
+static int write_book_position(FILE* out,
+        uint64_t key,
+        book_count_t* moves,
+        uint64_t* scores,
+        int num_moves)
+{
+    uint64_t max_score = 0;
+    for (int i=0; i<num_moves; ++i) max_score = MAX(max_score, scores[i]);
+    for (int i=0; i<num_moves; ++i) {
+        uint64_t weight = scores[i];
+        if (max_score > 0xffff) weight = MAX(1, weight * 0xffff / max_score);
+        moves[i].score = weight;
+    }
+    // Insertion sort by weight; there are never very many moves.
+    for (int i=1; i<num_moves; ++i) {
+        book_count_t move = moves[i];
+        int j = i;
+        for (; j>0 && moves[j-1].score < move.score; --j) moves[j] = moves[j-1];
+        moves[j] = move;
+    }
+    for (int i=0; i<num_moves; ++i) {
+        uint8_t record[16];
+        uint64_t k = my_htonll(key);
+        uint16_t m = my_htons(moves[i].move);
+        uint16_t w = my_htons((uint16_t)moves[i].score);
+        memcpy(record, &k, 8);
+        memcpy(record+8, &m, 2);
+        memcpy(record+10, &w, 2);
+        memset(record+12, 0, 4);
+        fwrite(record, 1, 16, out);
+    }
+    return num_moves;
+}
+
+/*
+ * Compile the games in |pgn_filename| into a Polyglot book |book_filename|
+ * that init_poly_book can load. Each move played in the first |max_ply|
+ * plies of a game scores 2 for its side if the game was won and 1 if it was
+ * drawn. Games without a result and losing moves add nothing. Scores are
+ * summed in a hash table of about |max_bytes|. Whenever it fills up, its
+ * contents are sorted and spilled to a temporary run file, and the runs are
+ * merged once all the games are read. Memory use is therefore bounded
+ * however large the input is.
+ */
+bool build_poly_book(char* pgn_filename,
+        char* book_filename,
+        int max_ply,
+        size_t max_bytes)
+{
+    pgn_reader_t* reader = malloc(sizeof(pgn_reader_t));
+    pgn_game_t* game = malloc(sizeof(pgn_game_t));
+    position_t* pos = malloc(sizeof(position_t));
+    if (!reader || !game || !pos || !open_pgn(reader, pgn_filename)) {
+        free(reader);
+        free(game);
+        free(pos);
+        return false;
+    }
+    int capacity = 1024;
+    while ((size_t)capacity*2*sizeof(book_count_t) <= max_bytes &&
+            capacity < (1<<30)) capacity *= 2;
+    book_count_t* table = calloc(capacity, sizeof(book_count_t));
+    FILE** runs = NULL;
+    int num_runs = 0, count = 0;
+    bool success = table != NULL;
+
+    // Aggregate scores, spilling the table whenever it's 3/4 full.
+    int num_games = 0, num_truncated = 0, num_unknown = 0;
+    while (success && read_pgn_game(reader, game)) {
+        ++num_games;
+        if (game->truncated) ++num_truncated;
+        if (game->result == PGN_RESULT_UNKNOWN) {
+            ++num_unknown;
+            continue;
+        }
+        copy_position(pos, &game->start);
+        for (int ply=0; ply<MIN(max_ply, game->num_moves); ++ply) {
+            move_t move = game->moves[ply];
+            color_t side = pos->side_to_move;
+            uint32_t score = game->result == PGN_DRAW ? 1 :
+                (game->result == PGN_WHITE_WINS) == (side == WHITE) ? 2 : 0;
+            if (score) {
+                uint64_t key = book_hash(pos);
+                uint16_t book_move = move_to_book_move(pos, move);
+                uint32_t slot = (key ^ book_move * 0x9e3779b97f4a7c15ull) >>
+                    32 & (capacity - 1);
+                while (table[slot].score && (table[slot].key != key ||
+                            table[slot].move != book_move)) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                if (!table[slot].score) {
+                    table[slot].key = key;
+                    table[slot].move = book_move;
+                    ++count;
+                }
+                table[slot].score += score;
+            }
+            undo_info_t undo;
+            do_move(pos, move, &undo);
+        }
+        if (count >= capacity / 4 * 3) {
+            success = spill_book_counts(table, capacity, &runs, &num_runs);
+            count = 0;
+        }
+        if (num_games % 100000 == 0) {
+            printf("%d games, %d runs\n", num_games, num_runs);
+        }
+    }
+    close_pgn(reader);
+    free(reader);
+    free(game);
+    free(pos);
+    if (success && count) {
+        success = spill_book_counts(table, capacity, &runs, &num_runs);
+    }
+    free(table);
+
+    // Merge the runs, combining the scores of matching moves and grouping
+    // moves by position. Each run holds its next unmerged entry in |heads|.
+    // There are only ever a handful of runs, so a linear scan finds the
+    // smallest head quickly enough.
+    book_count_t* heads = malloc((num_runs + 1) * sizeof(book_count_t));
+    bool* live = malloc((num_runs + 1) * sizeof(bool));
+    success = success && heads && live;
+    FILE* out = success ? fopen(book_filename, "wb") : NULL;
+    int num_positions = 0, num_entries = 0;
+    if (out) {
+        for (int i=0; i<num_runs; ++i) {
+            live[i] = fread(&heads[i], sizeof(book_count_t), 1, runs[i]) == 1;
+        }
+        book_count_t moves[256];
+        uint64_t scores[256];
+        int num_moves = 0;
+        while (true) {
+            int next = -1;
+            for (int i=0; i<num_runs; ++i) {
+                if (live[i] && (next < 0 ||
+                        book_count_cmp(&heads[i], &heads[next]) < 0)) {
+                    next = i;
+                }
+            }
+            if (num_moves && (next < 0 ||
+                        heads[next].key != moves[0].key)) {
+                num_entries += write_book_position(out, moves[0].key,
+                        moves, scores, num_moves);
+                ++num_positions;
+                num_moves = 0;
+            }
+            if (next < 0) break;
+            book_count_t entry = heads[next];
+            live[next] = fread(&heads[next],
+                    sizeof(book_count_t), 1, runs[next]) == 1;
+            if (num_moves && moves[num_moves-1].move == entry.move) {
+                scores[num_moves-1] += entry.score;
+            } else if (num_moves < 256) {
+                moves[num_moves] = entry;
+                scores[num_moves++] = entry.score;
+            }
+        }
+    } else if (success) {
+        printf("Couldn't create %s\n", book_filename);
+        success = false;
+    }
+    for (int i=0; i<num_runs; ++i) fclose(runs[i]);
+    free(runs);
+    free(heads);
+    free(live);
+    if (out) {
+        success = !ferror(out) && success;
+        success = !fclose(out) && success;
+    }
+    printf("Read %d games (%d truncated, %d without a result), "
+            "wrote %d positions and %d moves to %s using %d runs\n",
+            num_games, num_truncated, num_unknown,
+            num_positions, num_entries, book_filename, num_runs);
+    return success;
+}
@@ -1,5 +1,6 @@
 
 #include "daydreamer.h"
+#include <string.h>
 
 /*
  * Implementations of functions that don't exist on all platforms.
@@ -7,6 +8,89 @@
  * the Windows build and a standard 32-bit PRNG.
  */
 
+#ifndef WINDOWS_THREADS
+/*
+ * Start |f| in a new thread. Some platforms give new threads much smaller
+ * stacks than the main thread by default, so ask for THREAD_STACK_BYTES.
+ */
+int create_thread(thread_t* thread, void* (*f)(void*), void* arg)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_BYTES);
+    int err = pthread_create(thread, &attr, f, arg);
+    pthread_attr_destroy(&attr);
+    return err;
+}
+#endif
+
+/*
+ * The number of processors available, used as the default thread limit for
+ * multi-threaded benchmarks.
+ */
+int num_processors(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    return MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+}
+
+// Blocks smaller than this are cleared by the calling thread, and larger
+// blocks are split into pieces of at least this size.
+#define PARALLEL_CLEAR_BYTES    (16<<20)
+#define MAX_CLEAR_THREADS       16
+
+typedef struct {
+    char* start;
+    size_t bytes;
+} clear_range_t;
+
+static void* clear_range(void* arg)
+{
+    clear_range_t* range = arg;
+    memset(range->start, 0, range->bytes);
+    return NULL;
+}
+
+/*
+ * Zero |bytes| of memory starting at |mem|. Large blocks are split into
+ * page-aligned pieces that are cleared by separate threads, one per
+ * processor. When the memory is freshly allocated this also spreads the
+ * first touch of its pages across threads, which lets the os place them
+ * across NUMA nodes. Pieces that can't be given to a thread are cleared
+ * by the caller.
+ */
+void clear_memory(void* mem, size_t bytes)
+{
+    int num_threads = MIN(num_processors(), MAX_CLEAR_THREADS);
+    num_threads = MIN(num_threads, (int)(bytes / PARALLEL_CLEAR_BYTES));
+    if (num_threads <= 1) {
+        memset(mem, 0, bytes);
+        return;
+    }
+    clear_range_t ranges[MAX_CLEAR_THREADS];
+    thread_t threads[MAX_CLEAR_THREADS];
+    bool started[MAX_CLEAR_THREADS];
+    size_t piece = (bytes / num_threads + 4095) & ~(size_t)4095;
+    char* start = mem;
+    for (int i=0; i<num_threads; ++i) {
+        size_t offset = MIN(i * piece, bytes);
+        ranges[i].start = start + offset;
+        ranges[i].bytes = MIN(piece, bytes - offset);
+        started[i] = i && !thread_create(&threads[i], clear_range, &ranges[i]);
+    }
+    for (int i=0; i<num_threads; ++i) {
+        if (!started[i]) clear_range(&ranges[i]);
+    }
+    for (int i=1; i<num_threads; ++i) {
+        if (started[i]) thread_join(threads[i]);
+    }
+}
+
 #ifdef _WIN32
 
 void srandom_32(unsigned seed)
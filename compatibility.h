@@ -17,6 +17,9 @@ extern "C" {
 // This is needed to give access to some of the string handling functions
 // that we use.
 #define _GNU_SOURCE
+// Use 64-bit file offsets even in 32-bit builds, since books and saved hash
+// tables can be larger than 2GB.
+#define _FILE_OFFSET_BITS   64
 #define DIR_SEP     "/"
 #endif
 
@@ -30,8 +33,12 @@ int _strnicmp(const char *string1, const char *string2, size_t count);
 int _stricmp(const char *string1, const char *string2);
 char* strcasestr(register char *s, register char *find);
 char* strsep(char **stringp, const char *delim);
+#define fseeko          _fseeki64
+#define ftello          _ftelli64
 #define DIR_SEP     "\\"
 #else
+// Read-only file mappings are used for opening books where available.
+#define HAS_MMAP
 #endif
 
 #ifdef _MSC_VER
@@ -65,6 +72,73 @@ typedef __int16 int16_t;
 #define _PTHREADS
 #define _POSIX_PTHREAD_SEMANTICS
 
+// Thin wrappers over the native thread, mutex, and condition variable
+// primitives. Thread
+// functions take and return a void*, in the pthreads style. New threads get
+// a stack as large as a typical main thread's, so they can run a search.
+#define THREAD_STACK_BYTES  (8<<20)
+#ifdef WINDOWS_THREADS
+typedef CRITICAL_SECTION mutex_t;
+typedef HANDLE thread_t;
+#define mutex_init(x)       InitializeCriticalSection(x)
+#define mutex_lock(x)       EnterCriticalSection(x)
+#define mutex_unlock(x)     LeaveCriticalSection(x)
+#define mutex_destroy(x)    DeleteCriticalSection(x)
+typedef CONDITION_VARIABLE condition_t;
+#define condition_init(x)   InitializeConditionVariable(x)
+#define condition_wait(c, m)    SleepConditionVariableCS((c), (m), INFINITE)
+#define condition_broadcast(x)  WakeAllConditionVariable(x)
+#define condition_destroy(x)    ((void)(x))
+#define thread_create(t, f, arg) \
+    ((*(t) = CreateThread(NULL, THREAD_STACK_BYTES, \
+        (LPTHREAD_START_ROUTINE)(f), (arg), 0, NULL)) == NULL)
+#define thread_join(t)      do { \
+    WaitForSingleObject((t), INFINITE); \
+    CloseHandle(t); \
+} while (0)
+#define thread_yield()      SwitchToThread()
+#else
+#include <pthread.h>
+#include <sched.h>
+typedef pthread_mutex_t mutex_t;
+typedef pthread_t thread_t;
+#define mutex_init(x)       pthread_mutex_init((x), NULL)
+#define mutex_lock(x)       pthread_mutex_lock(x)
+#define mutex_unlock(x)     pthread_mutex_unlock(x)
+#define mutex_destroy(x)    pthread_mutex_destroy(x)
+typedef pthread_cond_t condition_t;
+#define condition_init(x)   pthread_cond_init((x), NULL)
+#define condition_wait(c, m)    pthread_cond_wait((c), (m))
+#define condition_broadcast(x)  pthread_cond_broadcast(x)
+#define condition_destroy(x)    pthread_cond_destroy(x)
+int create_thread(thread_t* thread, void* (*f)(void*), void* arg);
+#define thread_create(t, f, arg)    create_thread((t), (f), (arg))
+#define thread_join(t)      pthread_join((t), NULL)
+#define thread_yield()      sched_yield()
+#endif
+
+// Storage that each thread gets its own copy of.
+#ifdef _MSC_VER
+#define THREAD_LOCAL        __declspec(thread)
+#else
+#define THREAD_LOCAL        __thread
+#endif
+
+// Hint that the cache line holding |addr| will be read soon.
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#define prefetch(addr)      _mm_prefetch((char*)(addr), _MM_HINT_T0)
+#else
+#define prefetch(addr)      __builtin_prefetch(addr)
+#endif
+
+// Atomically add |x| to the integer at |ptr|.
+#ifdef _MSC_VER
+#define atomic_add(ptr, x)  InterlockedExchangeAdd((volatile LONG*)(ptr), (x))
+#else
+#define atomic_add(ptr, x)  __sync_fetch_and_add((ptr), (x))
+#endif
+
 // 32 or 64 bit?
 #if defined(__x86_64) || \
     defined(_WIN64) || \
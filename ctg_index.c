@@ -0,0 +1,18 @@
+
+#include "daydreamer.h"
+#include <stdio.h>
+
+/*
+ * Compile a .ctg book into a sorted zobrist-keyed index that init_ctg_book
+ * uses in place of the .cto/.ctg page lookup. The index is written next to
+ * the book with a .cti extension, and must be rebuilt if the book changes.
+ */
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        printf("ctg_index takes 1 argument, <ctg book>\n");
+        return -1;
+    }
+    init_lookup_tables();
+    return build_ctg_index(argv[1]) ? 0 : 1;
+}
@@ -4,13 +4,258 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <ctype.h>
 
-int main(int argc, char* argv[])
+/*
+ * Set |pos| from a query line. A line is either a bare FEN or a uci-style
+ * "position [startpos | fen <fen>] [moves <m1> ... <mn>]" command. Returns
+ * false if the line can't be interpreted.
+ */
+static bool parse_query(position_t* pos, char* line)
 {
-    // Set unbuffered i/o.
-    setbuf(stdout, NULL);
-    setbuf(stdin, NULL);
+    while (isspace(*line)) ++line;
+    if (!strncasecmp(line, "position", 8)) {
+        line += 8;
+        while (isspace(*line)) ++line;
+        if (!strncasecmp(line, "startpos", 8)) {
+            set_position(pos, FEN_STARTPOS);
+            line += 8;
+        } else if (!strncasecmp(line, "fen", 3)) {
+            line += 3;
+            while (isspace(*line)) ++line;
+            line = set_position(pos, line);
+        } else return false;
+    } else {
+        line = set_position(pos, line);
+    }
+    if (pos->num_pieces[WHITE] < 1 || pos->num_pieces[BLACK] < 1 ||
+            pos->board[pos->pieces[WHITE][0]] != WK ||
+            pos->board[pos->pieces[BLACK][0]] != BK) return false;
+
+    while (isspace(*line)) ++line;
+    if (!strncasecmp(line, "moves", 5)) {
+        line += 5;
+        while (isspace(*line)) ++line;
+        while (*line) {
+            move_t move = coord_str_to_move(pos, line);
+            if (move == NO_MOVE) return false;
+            undo_info_t undo;
+            do_move(pos, move, &undo);
+            while (*line && !isspace(*line)) ++line;
+            while (isspace(*line)) ++line;
+        }
+    }
+    return true;
+}
+
+/*
+ * Answer book queries from |stream| until it's exhausted or we read "quit".
+ * Each input line produces exactly one line of json output, so callers can
+ * pipeline requests without reopening the book.
+ */
+static void serve_queries(FILE* stream)
+{
+    char line[4096], fen[256];
+    position_t pos;
+    ctg_book_move_t book_moves[MAX_CTG_BOOK_MOVES];
+    while (fgets(line, sizeof(line), stream)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* query = line;
+        while (isspace(*query)) ++query;
+        if (!*query) continue;
+        if (!strcasecmp(query, "quit")) break;
+        if (!parse_query(&pos, query)) {
+            printf("{\"error\": \"invalid query\"}\n");
+            fflush(stdout);
+            continue;
+        }
+        position_to_fen_str(&pos, fen);
+        int num_moves = get_ctg_book_moves(&pos, book_moves);
+        printf("{\"fen\": \"%s\", \"moves\": [", fen);
+        for (int i=0; i<num_moves; ++i) {
+            if (i) printf(", ");
+            print_ctg_book_move(&book_moves[i]);
+        }
+        printf("]}\n");
+        fflush(stdout);
+    }
+}
 
+/*
+ * Read the queries in |filename| into a newly allocated array, and set
+ * |num_queries| to the number read. Lines that can't be interpreted are
+ * skipped. Returns NULL if the file can't be read.
+ */
+static position_t* read_queries(char* filename, int* num_queries)
+{
+    FILE* stream = fopen(filename, "r");
+    if (!stream) {
+        printf("Couldn't open query file %s\n", filename);
+        return NULL;
+    }
+    int max_queries = 1024;
+    *num_queries = 0;
+    position_t* queries = malloc(max_queries * sizeof(position_t));
+    char line[4096];
+    position_t pos;
+    while (fgets(line, sizeof(line), stream)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* query = line;
+        while (isspace(*query)) ++query;
+        if (!*query) continue;
+        if (!parse_query(&pos, query)) continue;
+        if (*num_queries == max_queries) {
+            // Positions point into themselves, so they have to be copied
+            // with copy_position rather than moved by realloc.
+            max_queries *= 2;
+            position_t* grown = malloc(max_queries * sizeof(position_t));
+            for (int i=0; i<*num_queries; ++i) {
+                copy_position(&grown[i], &queries[i]);
+            }
+            free(queries);
+            queries = grown;
+        }
+        copy_position(&queries[(*num_queries)++], &pos);
+    }
+    fclose(stream);
+    return queries;
+}
+
+/*
+ * Run every query in |filename| through the book, once with child positions
+ * looked up one at a time and once with batched child lookups, and report
+ * the i/o done per query and the cache behavior in each mode.
+ */
+static void ctg_bench(char* filename)
+{
+    int num_queries;
+    position_t* queries = read_queries(filename, &num_queries);
+    if (!queries) return;
+
+    ctg_book_move_t book_moves[MAX_CTG_BOOK_MOVES];
+    for (int batch=0; batch<2; ++batch) {
+        set_ctg_child_batching(batch);
+        clear_ctg_io_stats();
+        clear_ctg_cache();
+        milli_timer_t timer;
+        init_timer(&timer);
+        start_timer(&timer);
+        int total_moves = 0;
+        for (int i=0; i<num_queries; ++i) {
+            total_moves += get_ctg_book_moves(&queries[i], book_moves);
+        }
+        int elapsed = stop_timer(&timer);
+        printf("%s child lookups: %d queries, %d book moves, %d ms\n",
+                batch ? "batched" : "unbatched",
+                num_queries, total_moves, elapsed);
+        print_ctg_io_stats();
+        print_ctg_cache_stats();
+    }
+    free(queries);
+}
+
+/*
+ * The share of the multi-threaded benchmark done by one thread: every
+ * |stride|th query starting from |first|, repeated |passes| times. Threads
+ * never share positions, since probing modifies them temporarily.
+ */
+typedef struct {
+    ctg_book_t* book;
+    position_t* queries;
+    int num_queries;
+    int first;
+    int stride;
+    int passes;
+    int lookups;
+    int total_moves;
+} bench_thread_t;
+
+static void* bench_thread(void* arg)
+{
+    bench_thread_t* work = arg;
+    ctg_book_move_t book_moves[MAX_CTG_BOOK_MOVES];
+    for (int pass=0; pass<work->passes; ++pass) {
+        for (int i=work->first; i<work->num_queries; i+=work->stride) {
+            work->total_moves += probe_ctg_book(work->book,
+                    &work->queries[i], book_moves);
+            ++work->lookups;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Probe a single shared handle on |book_name| from 1, 2, 4, ... up to
+ * |max_threads| threads at once, and report lookups per second at each
+ * thread count. Each query is run enough times that a pass takes a
+ * measurable amount of time.
+ */
+static void ctg_mt_bench(char* book_name, char* filename, int max_threads)
+{
+    int num_queries;
+    position_t* queries = read_queries(filename, &num_queries);
+    if (!queries) return;
+    ctg_book_t* book = open_ctg_book(book_name);
+    if (!book || !num_queries) {
+        free(queries);
+        close_ctg_book(book);
+        return;
+    }
+    int passes = MAX(1, 200000 / num_queries);
+    bench_thread_t* work = malloc(max_threads * sizeof(bench_thread_t));
+    thread_t* threads = malloc(max_threads * sizeof(thread_t));
+    double base_rate = 0;
+    for (int num_threads=1; ; num_threads=MIN(2*num_threads, max_threads)) {
+        // Start each round from fresh copies of the positions. The threads
+        // split them between them, so no position is probed by two threads
+        // at once. Everything else a probe touches is in the book handle.
+        position_t* copies = malloc(num_queries * sizeof(position_t));
+        for (int i=0; i<num_queries; ++i) {
+            copy_position(&copies[i], &queries[i]);
+        }
+        milli_timer_t timer;
+        init_timer(&timer);
+        start_timer(&timer);
+        int started = 0;
+        for (; started<num_threads; ++started) {
+            bench_thread_t* w = &work[started];
+            w->book = book;
+            w->queries = copies;
+            w->num_queries = num_queries;
+            w->first = started;
+            w->stride = num_threads;
+            w->passes = passes;
+            w->lookups = w->total_moves = 0;
+            if (thread_create(&threads[started], bench_thread, w)) break;
+        }
+        int lookups = 0, total_moves = 0;
+        for (int i=0; i<started; ++i) {
+            thread_join(threads[i]);
+            lookups += work[i].lookups;
+            total_moves += work[i].total_moves;
+        }
+        int elapsed = MAX(stop_timer(&timer), 1);
+        free(copies);
+        if (started < num_threads) {
+            printf("Couldn't create thread %d\n", started);
+            break;
+        }
+        double rate = lookups * 1000.0 / elapsed;
+        if (num_threads == 1) base_rate = rate;
+        printf("%d threads: %d lookups, %d book moves, %d ms, "
+                "%.0f lookups/sec (%.2fx)\n",
+                num_threads, lookups, total_moves, elapsed,
+                rate, rate / MAX(base_rate, 1));
+        if (num_threads == max_threads) break;
+    }
+    free(work);
+    free(threads);
+    free(queries);
+    close_ctg_book(book);
+}
+
+int main(int argc, char* argv[])
+{
     // Print some identifying information, then do initialization.
     // printf("%s %s, by %s\n", ENGINE_NAME, ENGINE_VERSION, ENGINE_AUTHOR);
     // printf("Compiled %s %s", __DATE__, __TIME__);
@@ -18,9 +263,50 @@ int main(int argc, char* argv[])
     // printf(", using:\n%s", COMPILE_COMMAND);
 // #endif
     // printf("\n");
+    init_lookup_tables();
+
+    if (argc == 2) {
+        // Server mode: keep the book open and answer one query per line.
+        // Output is flushed per response rather than per write.
+        if (!init_ctg_book(argv[1])) return -1;
+        serve_queries(stdin);
+        return 0;
+    }
+
+    if (argc == 4 && !strcasecmp(argv[2], "bench")) {
+        if (!init_ctg_book(argv[1])) return -1;
+        ctg_bench(argv[3]);
+        return 0;
+    }
+
+    if ((argc == 3 || argc == 4) && !strcasecmp(argv[2], "dump")) {
+        // Export the whole book as json lines, to stdout or to a file.
+        FILE* out = argc == 4 ? fopen(argv[3], "w") : stdout;
+        if (!out) {
+            printf("Couldn't create %s\n", argv[3]);
+            return -1;
+        }
+        bool success = dump_ctg_book(argv[1], out);
+        if (out != stdout) success = !fclose(out) && success;
+        return success ? 0 : -1;
+    }
+
+    if ((argc == 4 || argc == 5) && !strcasecmp(argv[2], "mtbench")) {
+        int max_threads = argc == 5 ? atoi(argv[4]) : num_processors();
+        ctg_mt_bench(argv[1], argv[3], MAX(max_threads, 1));
+        return 0;
+    }
+
+    // Set unbuffered i/o.
+    setbuf(stdout, NULL);
+    setbuf(stdin, NULL);
 
     if (argc != 3) {
-        printf("CtgLookup currently takes 2 argument, <ctg book> <fen> \n");
+        printf("CtgLookup takes <ctg book> <fen> for a single lookup, "
+                "just <ctg book> to read queries from stdin, or "
+                "<ctg book> bench <query file>, "
+                "<ctg book> mtbench <query file> [max threads], or "
+                "<ctg book> dump [output file]\n");
         return -1;
     }
     set_position(&root_data.root_pos, argv[2]);
@@ -31,6 +317,7 @@ int main(int argc, char* argv[])
 
 
 
+
     // init_daydreamer();
 
     // // Read from uci script, if possible.
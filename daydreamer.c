@@ -8,18 +8,27 @@ options_t options;
 bool big_endian;
 
 /*
- * Set up the stuff that only needs to be done once, during initialization.
+ * Set up the lookup tables that position handling depends on. This is all
+ * the initialization that the standalone book tools need.
  */
-void init_daydreamer(void)
+void init_lookup_tables(void)
 {
     // Figure out if we're on a big- or little-endian system.
     const int i = 1;
     big_endian = (*(char*)&i) == 0;
 
     init_hash();
-    init_material_table(4*1024*1024);
     init_bitboards();
     generate_attack_data();
+}
+
+/*
+ * Set up the stuff that only needs to be done once, during initialization.
+ */
+void init_daydreamer(void)
+{
+    init_lookup_tables();
+    init_material_table(4*1024*1024);
     init_eval();
     init_uci_options();
     set_position(&root_data.root_pos, FEN_STARTPOS);
@@ -14,6 +14,7 @@ extern "C" {
 
 #include "compatibility.h"
 #include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #ifndef MIN
@@ -37,6 +38,8 @@ extern "C" {
 #include "search.h"
 #include "trans_table.h"
 #include "move_selection.h"
+#include "book_ctg.h"
+#include "pgn.h"
 #include "debug.h"
 
 /*
@@ -48,12 +51,17 @@ void generate_attack_data(void);
 direction_t pin_direction(const position_t* pos,
         square_t from,
         square_t king_sq);
+void find_pins(const position_t* pos, pin_info_t* pins);
 bool is_square_attacked(const position_t* pos, square_t square, color_t side);
 bool piece_attacks_near(const position_t* pos, square_t from, square_t target);
 uint8_t find_checks(position_t* pos);
 
 // benchmark.c
 void benchmark(int depth, int time_limit);
+void smp_benchmark(int depth, int max_threads);
+void page_benchmark(int depth, const int* hash_mbytes, int num_sizes);
+void hash_policy_benchmark(int depth, int hash_mbytes);
+void eval_benchmark(int passes);
 
 // bitboard.c
 void init_bitboards(void);
@@ -62,20 +70,56 @@ void print_bitboard(bitboard_t bb);
 // book_poly.c
 bool init_poly_book(char* filename);
 move_t get_poly_book_move(position_t* pos);
+void set_poly_book_preload(int max_bytes);
+void poly_book_bench(char* filename, int num_probes);
+bool build_poly_book(char* pgn_filename,
+        char* book_filename,
+        int max_ply,
+        size_t max_bytes);
 void test_book(char* filename, position_t* pos);
 
 // book_ctg.c
+ctg_book_t* open_ctg_book(char* filename);
+void close_ctg_book(ctg_book_t* book);
+int probe_ctg_book(ctg_book_t* book,
+        position_t* pos,
+        ctg_book_move_t* book_moves);
+int probe_ctg_entries(ctg_book_t* book,
+        position_t* positions,
+        int num_positions,
+        ctg_entry_t* entries,
+        bool* found);
 bool init_ctg_book(char* filename);
 move_t get_ctg_book_move(position_t* pos);
+int get_ctg_book_moves(position_t* pos, ctg_book_move_t* moves);
+void print_ctg_book_move(const ctg_book_move_t* book_move);
+int get_ctg_entries(position_t* positions,
+        int num_positions,
+        ctg_entry_t* entries,
+        bool* found);
+void set_ctg_child_batching(bool batch);
+void clear_ctg_io_stats(void);
+void print_ctg_io_stats(void);
+void init_ctg_cache(const int max_bytes);
+void clear_ctg_cache(void);
+void print_ctg_cache_stats(void);
+bool build_ctg_index(char* filename);
+bool dump_ctg_book(char* filename, FILE* out);
 
 // compatibility.c
+int num_processors(void);
+void clear_memory(void* mem, size_t bytes);
 void srandom_32(unsigned seed);
 int32_t random_32(void);
 int64_t random_64(void);
 
 // daydreamer.c
+void init_lookup_tables(void);
 void init_daydreamer(void);
 
+// driver.c
+int engine_main(int argc, char* argv[]);
+
 // scorpio_bb.c
 bool load_scorpio_bb(char* egbb_dir, int cache_size_bytes);
 void unload_scorpio_bb(void);
@@ -98,8 +142,11 @@ score_t evaluate_king_safety(const position_t* pos, eval_data_t* ed);
 
 // eval_material.c
 void init_material_table(const int max_bytes);
+void init_thread_material_table(void);
+void free_material_table(void);
 void clear_material_table(void);
 material_data_t* get_material_data(const position_t* pos);
+void prefetch_material_data(hashkey_t key);
 int game_phase(const position_t* pos);
 
 // eval_patterns.c
@@ -107,8 +154,11 @@ score_t pattern_score(const position_t*pos);
 
 // eval_pawns.c
 void init_pawn_table(const int max_bytes);
+void init_thread_pawn_table(void);
+void free_pawn_table(void);
 void clear_pawn_table(void);
 score_t pawn_score(const position_t* pos, pawn_data_t** pawn_data);
+void prefetch_pawn_data(hashkey_t key);
 void print_pawn_stats(void);
 
 // eval_pieces.c
@@ -141,9 +191,12 @@ void do_move(position_t* position, move_t move, undo_info_t* undo);
 void undo_move(position_t* position, move_t move, undo_info_t* undo);
 void do_nullmove(position_t* pos, undo_info_t* undo);
 void undo_nullmove(position_t* pos, undo_info_t* undo);
+void save_position_state(const position_t* pos, position_state_t* state);
+void restore_position_state(position_t* pos, const position_state_t* state);
 
 // move_generation.c
 int generate_legal_moves(position_t* pos, move_t* moves);
+int filter_legal_moves(position_t* pos, move_t* moves, int num_moves);
 int generate_pseudo_moves(const position_t* position, move_t* move_list);
 int generate_pseudo_tactical_moves(const position_t* pos, move_t* moves);
 int generate_pseudo_quiet_moves(const position_t* pos, move_t* moves);
@@ -157,6 +210,7 @@ int generate_quiescence_moves(const position_t* pos,
 void init_move_selector(move_selector_t* sel,
         position_t* pos,
         generation_t gen_type,
+        search_data_t* data,
         search_node_t* search_node,
         move_t hash_move,
         float depth,
@@ -180,7 +234,14 @@ void print_search_stats(const search_data_t* search_data);
 void print_board(const position_t* pos, bool uci_prefix);
 void print_multipv(search_data_t* data);
 
+// pgn.c
+bool open_pgn(pgn_reader_t* reader, char* filename);
+void close_pgn(pgn_reader_t* reader);
+bool read_pgn_game(pgn_reader_t* reader, pgn_game_t* game);
+
 // perft.c
+void init_perft_table(const size_t max_bytes);
+void clear_perft_table(void);
 void perft_testsuite(char* filename);
 uint64_t perft(position_t* position, int depth, bool divide);
 
@@ -198,6 +259,7 @@ bool is_repetition(const position_t* pos);
 void init_search_data(search_data_t* data);
 void init_root_move(root_move_t* root_move, move_t move);
 bool should_stop_searching(search_data_t* data);
+uint64_t total_nodes_searched(const search_data_t* data);
 void store_root_node_count(move_t move, uint64_t nodes);
 void deepening_search(search_data_t* search_data, bool ponder);
 
@@ -214,8 +276,10 @@ int elapsed_time(milli_timer_t* timer);
 // trans_table.c
 void init_transposition_table(const size_t max_bytes);
 void clear_transposition_table(void);
+void lazy_clear_transposition_table(void);
 void increment_transposition_age(void);
-transposition_entry_t* get_transposition(position_t* pos);
+transposition_entry_t* get_transposition(position_t* pos,
+        transposition_entry_t* entry);
 void put_transposition(position_t* pos,
         move_t move,
         float depth,
@@ -228,8 +292,15 @@ void put_transposition_line(position_t* pos,
         int score,
         score_type_t score_type);
 void print_transposition_stats(void);
+void stress_transposition_table(int num_threads, int iterations);
+const char* get_transposition_page_mode(void);
+void prefetch_transposition(hashkey_t key);
+bool save_transposition_table(const char* filename);
+bool load_transposition_table(const char* filename);
+void get_transposition_hit_counts(uint64_t* hits, uint64_t* misses);
 
 // uci.c
+extern volatile bool uci_input_pending;
 void uci_read_stream(FILE* stream);
 void uci_check_for_command(void);
 void uci_wait_for_command(void);
@@ -0,0 +1,10 @@
+#include "daydreamer.h"
+
+/*
+ * Run the UCI engine. The engine itself is in driver.c, so that the book
+ * tools can link against the same objects.
+ */
+int main(int argc, char* argv[])
+{
+    return engine_main(argc, argv);
+}
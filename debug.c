@@ -25,6 +25,20 @@ void _check_board_validity(const position_t* pos)
             assert(pos->pieces[side][pos->piece_index[sq]] == sq);
         }
     }
+#ifdef BITBOARD_MOVEGEN
+    for (square_t sq=A1; sq<=H8; ++sq) {
+        if (!valid_board_index(sq)) continue;
+        piece_t piece = pos->board[sq];
+        (void)piece; // Avoid warning when NDEBUG is defined.
+        for (piece_t p=WP; p<=BK; ++p) {
+            assert(!sq_bit_is_set(pos->piece_bb[p], sq) == (piece != p));
+        }
+        assert(!sq_bit_is_set(pos->color_bb[WHITE], sq) ==
+                (!piece || piece_color(piece) != WHITE));
+        assert(!sq_bit_is_set(pos->color_bb[BLACK], sq) ==
+                (!piece || piece_color(piece) != BLACK));
+    }
+#endif
     assert(my_piece_count[WK] == 1);
     assert(my_piece_count[BK] == 1);
     for (int i=0; i<16; ++i) {
@@ -2,11 +2,14 @@
 #include "daydreamer.h"
 #include <string.h>
 
-static material_data_t* material_table = NULL;
+// Each search thread has its own material table, so that entries never
+// change underneath the thread using them.
+static THREAD_LOCAL material_data_t* material_table = NULL;
 static void compute_material_data(const position_t* pos, material_data_t* md);
 
-static int num_buckets;
-static struct {
+static int material_table_bytes;
+static THREAD_LOCAL int num_buckets;
+static THREAD_LOCAL struct {
     int misses;
     int hits;
     int occupied;
@@ -14,11 +17,24 @@ static struct {
 } material_hash_stats;
 
 /*
- * Create a material hash table of the appropriate size.
+ * Create a material hash table of the appropriate size for the calling
+ * thread. Tables created later by init_thread_material_table use the
+ * same size.
  */
 void init_material_table(const int max_bytes)
 {
     assert(max_bytes >= 1024);
+    material_table_bytes = max_bytes;
+    init_thread_material_table();
+}
+
+/*
+ * Give the calling thread its own material table, the same size as the
+ * one created by the last call to init_material_table.
+ */
+void init_thread_material_table(void)
+{
+    const int max_bytes = material_table_bytes;
     int size = sizeof(material_data_t);
     num_buckets = 1;
     while (size <= max_bytes >> 1) {
@@ -31,15 +47,33 @@ void init_material_table(const int max_bytes)
     clear_material_table();
 }
 
+/*
+ * Release the calling thread's material table.
+ */
+void free_material_table(void)
+{
+    free(material_table);
+    material_table = NULL;
+}
+
 /*
  * Wipe the entire table.
  */
 void clear_material_table(void)
 {
-    memset(material_table, 0, sizeof(material_data_t) * num_buckets);
+    clear_memory(material_table, sizeof(material_data_t) * num_buckets);
     memset(&material_hash_stats, 0, sizeof(material_hash_stats));
 }
 
+/*
+ * Start loading the material table entry for |key| into the cache. Threads
+ * without a material table of their own skip this.
+ */
+void prefetch_material_data(hashkey_t key)
+{
+    if (material_table) prefetch(&material_table[key % num_buckets]);
+}
+
 /*
  * Look up the material data for the given position.
  */
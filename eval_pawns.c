@@ -72,9 +72,11 @@ static const int central_space[0x80] = {
     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
 };
 
-static pawn_data_t* pawn_table = NULL;
-static int num_buckets;
-static struct {
+// Pawn tables are per-thread, like material tables.
+static THREAD_LOCAL pawn_data_t* pawn_table = NULL;
+static int pawn_table_bytes;
+static THREAD_LOCAL int num_buckets;
+static THREAD_LOCAL struct {
     int misses;
     int hits;
     int occupied;
@@ -82,11 +84,23 @@ static struct {
 } pawn_hash_stats;
 
 /*
- * Create a pawn hash table of the appropriate size.
+ * Create a pawn hash table of the appropriate size for the calling thread.
+ * Tables created later by init_thread_pawn_table use the same size.
  */
 void init_pawn_table(const int max_bytes)
 {
     assert(max_bytes >= 1024);
+    pawn_table_bytes = max_bytes;
+    init_thread_pawn_table();
+}
+
+/*
+ * Give the calling thread its own pawn table, the same size as the one
+ * created by the last call to init_pawn_table.
+ */
+void init_thread_pawn_table(void)
+{
+    const int max_bytes = pawn_table_bytes;
     int size = sizeof(pawn_data_t);
     num_buckets = 1;
     while (size <= max_bytes >> 1) {
@@ -99,15 +113,33 @@ void init_pawn_table(const int max_bytes)
     clear_pawn_table();
 }
 
+/*
+ * Release the calling thread's pawn table.
+ */
+void free_pawn_table(void)
+{
+    free(pawn_table);
+    pawn_table = NULL;
+}
+
 /*
  * Wipe the entire table.
  */
 void clear_pawn_table(void)
 {
-    memset(pawn_table, 0, sizeof(pawn_data_t) * num_buckets);
+    clear_memory(pawn_table, sizeof(pawn_data_t) * num_buckets);
     memset(&pawn_hash_stats, 0, sizeof(pawn_hash_stats));
 }
 
+/*
+ * Start loading the pawn table entry for |key| into the cache. Threads
+ * without a pawn table of their own skip this.
+ */
+void prefetch_pawn_data(hashkey_t key)
+{
+    if (pawn_table) prefetch(&pawn_table[key % num_buckets]);
+}
+
 /*
  * Look up the pawn data for the pawns in the given position.
  */
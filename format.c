@@ -134,8 +134,10 @@ move_t coord_str_to_move(position_t* pos, const char* coord_move)
 
 /*
  * For a given move in a position, determine any ambiguities to be resolved in
- * the move's SAN representation. These are other pieces of the same type
- * on the same rank or file that can move to the destination square.
+ * the move's SAN representation. If other pieces of the same type can move
+ * to the destination square, the source file is given if it's unique
+ * (AMBIG_RANK), otherwise the source rank if that's unique (AMBIG_FILE),
+ * and otherwise both.
  */
 static ambiguity_t determine_move_ambiguity(position_t* pos, move_t move)
 {
@@ -146,17 +148,21 @@ static ambiguity_t determine_move_ambiguity(position_t* pos, move_t move)
     piece_type_t type = get_move_piece_type(move);
     move_t moves[256];
     generate_legal_moves(pos, moves);
-    ambiguity_t ambiguity = AMBIG_NONE;
+    bool ambiguous = false, same_rank = false, same_file = false;
     for (move_t* other_move = moves; *other_move; ++other_move) {
         if (*other_move == move) continue;
         if (get_move_to(*other_move) != dest) continue;
         if (get_move_piece_type(*other_move) != type) continue;
         square_t other_from = get_move_from(*other_move);
         if (from == other_from) continue;
-        if (square_rank(other_from) == from_rank) ambiguity |= AMBIG_RANK;
-        if (square_file(other_from) == from_file) ambiguity |= AMBIG_FILE;
+        ambiguous = true;
+        if (square_rank(other_from) == from_rank) same_rank = true;
+        if (square_file(other_from) == from_file) same_file = true;
     }
-    return ambiguity;
+    if (!ambiguous) return AMBIG_NONE;
+    if (!same_file) return AMBIG_RANK;
+    if (!same_rank) return AMBIG_FILE;
+    return AMBIG_RANK | AMBIG_FILE;
 }
 
 /*
@@ -266,9 +272,15 @@ move_t san_str_to_move(position_t* pos, char* san)
     end--;
     square_t to_sq = create_square(to_file, to_rank);
 
+    // Pawn moves start with the file they're on, which has to be kept for
+    // captures. Piece letters are accepted in either case, except for 'b',
+    // which is always a file.
+    piece_type_t piece_type = PAWN;
     char* piece_pos = strchr(glyphs, toupper(san[0]));
-    piece_type_t piece_type = piece_pos ? piece_pos - glyphs : PAWN;
-    san++;
+    if (piece_pos && (san[0] < 'a' || san[0] > 'h')) {
+        piece_type = piece_pos - glyphs;
+        san++;
+    }
     if (san <= end && *san <= 'h' && *san >= 'a') {
         from_file = *san - 'a';
         san++;
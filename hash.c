@@ -2,9 +2,9 @@
 #include "daydreamer.h"
 #include <string.h>
 
-const hashkey_t piece_random[2][7][64];
-const hashkey_t castle_random[2][2][2];
-const hashkey_t enpassant_random[64];
+hashkey_t piece_random[2][7][64];
+hashkey_t castle_random[2][2][2];
+hashkey_t enpassant_random[64];
 
 /*
  * Get a 64 bit random key, used for hashing. Unfortunately this has to
@@ -28,9 +28,9 @@ void init_hash(void)
 {
     int i;
     srandom_32(1);
-    hashkey_t* _piece_random = (hashkey_t*)&piece_random[0][0][0];
-    hashkey_t* _castle_random = (hashkey_t*)&castle_random[0][0][0];
-    hashkey_t* _enpassant_random = (hashkey_t*)&enpassant_random[0];
+    hashkey_t* _piece_random = &piece_random[0][0][0];
+    hashkey_t* _castle_random = &castle_random[0][0][0];
+    hashkey_t* _enpassant_random = &enpassant_random[0];
 
     for (i=0; i<2*7*64; ++i) _piece_random[i] = random_hashkey();
     for (i=0; i<64; ++i) _enpassant_random[i] = random_hashkey();
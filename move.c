@@ -1,5 +1,6 @@
 
 #include "daydreamer.h"
+#include <string.h>
 
 /*
  * Modify |pos| by adding |piece| to |square|. If |square| is occupied, its
@@ -18,6 +19,10 @@ void place_piece(position_t* pos, piece_t piece, square_t square)
     assert(square != INVALID_SQUARE);
 
     pos->board[square] = piece;
+#ifdef BITBOARD_MOVEGEN
+    set_sq_bit(pos->piece_bb[piece], square);
+    set_sq_bit(pos->color_bb[color], square);
+#endif
     if (piece_is_type(piece, PAWN)) {
         int index = pos->num_pawns[color]++;
         pos->pawns[color][index] = square;
@@ -71,6 +76,10 @@ void remove_piece(position_t* pos, square_t square)
         }
     }
     pos->board[square] = EMPTY;
+#ifdef BITBOARD_MOVEGEN
+    clear_sq_bit(pos->piece_bb[piece], square);
+    clear_sq_bit(pos->color_bb[color], square);
+#endif
     pos->piece_index[square] = -1;
     pos->piece_count[piece]--;
     pos->hash ^= piece_hash(piece, square);
@@ -98,6 +107,12 @@ void transfer_piece(position_t* pos, square_t from, square_t to)
     int index = pos->piece_index[to] = pos->piece_index[from];
     color_t color = piece_color(p);
     pos->board[from] = EMPTY;
+#ifdef BITBOARD_MOVEGEN
+    bitboard_t from_to = set_mask[square_to_index(from)] |
+        set_mask[square_to_index(to)];
+    pos->piece_bb[p] ^= from_to;
+    pos->color_bb[color] ^= from_to;
+#endif
     if (piece_is_type(p, PAWN)) {
         pos->pawns[color][index] = to;
         pos->piece_index[to] = index;
@@ -197,14 +212,19 @@ void do_move(position_t* pos, move_t move, undo_info_t* undo)
         place_piece(pos, create_piece(side, promote_type), to);
     }
 
-    pos->hash_history[pos->ply++] = undo->hash;
-    assert(pos->ply <= HASH_HISTORY_LENGTH);
+    pos->hash_history[pos->ply++ & (HASH_HISTORY_LENGTH-1)] = undo->hash;
     pos->side_to_move ^= 1;
-    pos->is_check = find_checks(pos);
-    pos->prev_move = move;
     pos->hash ^= ep_hash(pos);
     pos->hash ^= castle_hash(pos);
     pos->hash ^= side_hash(pos);
+
+    // The keys are final now, so start loading the hash table entries for
+    // the new position while we look for checks.
+    prefetch_transposition(pos->hash);
+    prefetch_pawn_data(pos->pawn_hash);
+    prefetch_material_data(pos->material_hash);
+    pos->is_check = find_checks(pos);
+    pos->prev_move = move;
     check_board_validity(pos);
 }
 
@@ -279,7 +299,7 @@ void do_nullmove(position_t* pos, undo_info_t* undo)
     pos->ep_square = EMPTY;
     pos->hash ^= ep_hash(pos);
     pos->fifty_move_counter++;
-    pos->hash_history[pos->ply++] = undo->hash;
+    pos->hash_history[pos->ply++ & (HASH_HISTORY_LENGTH-1)] = undo->hash;
     pos->prev_move = NULL_MOVE;
     check_board_validity(pos);
 }
@@ -303,3 +323,21 @@ void undo_nullmove(position_t* pos, undo_info_t* undo)
     check_board_validity(pos);
 }
 
+/*
+ * Copy the per-ply state of |pos| into |state|, so that a move can later be
+ * undone by restore_position_state() instead of undo_move().
+ */
+void save_position_state(const position_t* pos, position_state_t* state)
+{
+    memcpy(state, pos, POSITION_STATE_BYTES);
+}
+
+/*
+ * Put |pos| back the way it was when |state| was saved from it. The hash
+ * history needs no repair: entries past the restored ply are just ignored.
+ */
+void restore_position_state(position_t* pos, const position_state_t* state)
+{
+    memcpy(pos, state, POSITION_STATE_BYTES);
+    check_board_validity(pos);
+}
@@ -39,19 +39,47 @@ static move_t* add_move(const position_t* pos,
 int generate_legal_moves(position_t* pos, move_t* moves)
 {
     if (is_check(pos)) return generate_evasions(pos, moves);
-    int num_pseudo = generate_pseudo_moves(pos, moves);
-    move_t* moves_tail = moves+num_pseudo;
-    move_t* moves_curr = moves;
-    while (moves_curr < moves_tail) {
-        check_pseudo_move_legality(pos, *moves_curr);
-        if (!is_pseudo_move_legal(pos, *moves_curr)) {
-            *moves_curr = *(--moves_tail);
-            *moves_tail = 0;
+    return filter_legal_moves(pos, moves, generate_pseudo_moves(pos, moves));
+}
+
+/*
+ * Remove the illegal moves from a list of |num_moves| pseudo-legal moves,
+ * keeping the legal ones in their original order, and return the number of
+ * legal moves. Pins are found once for the whole list, so only king moves
+ * and en passant captures need any real work.
+ */
+int filter_legal_moves(position_t* pos, move_t* moves, int num_moves)
+{
+    // Evasions are generated legal to begin with.
+    if (is_check(pos)) return num_moves;
+    pin_info_t pins;
+    find_pins(pos, &pins);
+    color_t side = pos->side_to_move;
+    int num_legal = 0;
+    for (int i=0; i<num_moves; ++i) {
+        move_t move = moves[i];
+        square_t from = get_move_from(move);
+        square_t to = get_move_to(move);
+        check_pseudo_move_legality(pos, move);
+        bool legal = true;
+        if (piece_is_type(get_move_piece(move), KING)) {
+            if (options.chess960 && is_move_castle(move)) {
+                legal = is_pseudo_move_legal(pos, move);
+            } else legal = !is_square_attacked(pos, to, side^1);
+        } else if (is_move_enpassant(move)) {
+            legal = is_pseudo_move_legal(pos, move);
         } else {
-            ++moves_curr;
+            for (int j=0; j<pins.num_pinned; ++j) {
+                if (pins.pinned[j] != from) continue;
+                legal = abs(pins.pin_dir[j]) == abs(direction(from, to));
+                break;
+            }
         }
+        assert2(legal == is_pseudo_move_legal(pos, move));
+        if (legal) moves[num_legal++] = move;
     }
-    return moves_tail-moves;
+    moves[num_legal] = NO_MOVE;
+    return num_legal;
 }
 
 /*
@@ -95,6 +123,7 @@ int generate_quiescence_moves(const position_t* pos,
     return moves-moves_head;
 }
 
+#ifndef BITBOARD_MOVEGEN
 /*
  * Fill the provided list with all pseudolegal captures in the given position.
  */
@@ -117,21 +146,18 @@ static int generate_pseudo_captures(const position_t* pos, move_t* moves)
     *moves = 0;
     return moves-moves_head;
 }
+#endif
 
 /*
- * Generate pseudo-legal moves which are neither captures nor promotions.
+ * Add all pseudo-legal castles. Castles are considered pseudo-legal if we
+ * have appropriate castling rights, the squares between king and rook are
+ * unoccupied, and the intermediate square is unattacked. Therefore checking
+ * for legality just requires seeing if we're in check afterwards.
  */
-int generate_pseudo_quiet_moves(const position_t* pos, move_t* moves)
+static move_t* generate_castles(const position_t* pos, move_t* moves)
 {
-    move_t* moves_head = moves;
     color_t side = pos->side_to_move;
-    piece_t piece;
-    square_t from;
 
-    // Castling. Castles are considered pseudo-legal if we have appropriate
-    // castling rights, the squares between king and rook are unoccupied,
-    // and the intermediate square is unattacked. Therefore checking for
-    // legality just requires seeing if we're in check afterwards.
     // This is messy for Chess960, so it's separated into separate cases.
     square_t my_king_home = king_home + side*A8;
     if (!options.chess960) {
@@ -229,7 +255,21 @@ int generate_pseudo_quiet_moves(const position_t* pos, move_t* moves)
                     moves);
         }
     }
+    return moves;
+}
+
+#ifndef BITBOARD_MOVEGEN
+/*
+ * Generate pseudo-legal moves which are neither captures nor promotions.
+ */
+int generate_pseudo_quiet_moves(const position_t* pos, move_t* moves)
+{
+    move_t* moves_head = moves;
+    color_t side = pos->side_to_move;
+    piece_t piece;
+    square_t from;
 
+    moves = generate_castles(pos, moves);
     for (int i = 0; i < pos->num_pieces[side]; ++i) {
         from = pos->pieces[side][i];
         piece = pos->board[from];
@@ -246,6 +286,7 @@ int generate_pseudo_quiet_moves(const position_t* pos, move_t* moves)
     *moves = 0;
     return (moves-moves_head);
 }
+#endif
 
 /*
  * Add all pseudo-legal non-capturing promotions.
@@ -271,6 +312,7 @@ static int generate_promotions(const position_t* pos, move_t* moves)
     return (moves-moves_head);
 }
 
+#ifndef BITBOARD_MOVEGEN
 /*
  * Generate all moves that evade check in the given position. This is purely
  * legal move generation; no pseudo-legal moves.
@@ -456,6 +498,7 @@ int generate_evasions(const position_t* pos, move_t* moves)
     *moves = 0;
     return moves-moves_head;
 }
+#endif
 
 /*
  * Generate all non-capturing, non-promoting, pseudo-legal checks. Used for
@@ -891,3 +934,267 @@ static void generate_piece_noncaptures(const position_t* pos,
     *moves_head = moves;
 }
 
+#ifdef BITBOARD_MOVEGEN
+/*
+ * Bitboard move generation. These replace the 0x88 versions of
+ * generate_pseudo_captures, generate_pseudo_quiet_moves, and
+ * generate_evasions when built with BITBOARD_MOVEGEN. The generated moves
+ * are the same, although they may come out in a different order.
+ */
+
+#define pawn_shift(bb, side, delta) \
+    ((side) == WHITE ? (bb) << (delta) : (bb) >> (delta))
+
+/*
+ * Get the squares attacked by a piece of type |type| on |ind|, given the
+ * occupied squares |occupied|. Pawns aren't handled here.
+ */
+static bitboard_t piece_attacks_bb(piece_type_t type,
+        int ind,
+        bitboard_t occupied)
+{
+    switch (type) {
+        case KNIGHT: return knight_attacks[ind];
+        case BISHOP: return bishop_attacks(ind, occupied);
+        case ROOK: return rook_attacks(ind, occupied);
+        case QUEEN: return queen_attacks(ind, occupied);
+        case KING: return king_attacks[ind];
+        default: assert(false);
+    }
+    return EMPTY_BB;
+}
+
+/*
+ * Get all pieces belonging to |side| that attack |ind|, given the occupied
+ * squares |occupied|.
+ */
+static bitboard_t attackers_bb(const position_t* pos,
+        int ind,
+        bitboard_t occupied,
+        color_t side)
+{
+    const bitboard_t* bb = pos->piece_bb;
+    bitboard_t queens = bb[create_piece(side, QUEEN)];
+    return (pawn_attacks[side^1][ind] & bb[create_piece(side, PAWN)]) |
+        (knight_attacks[ind] & bb[create_piece(side, KNIGHT)]) |
+        (king_attacks[ind] & bb[create_piece(side, KING)]) |
+        (bishop_attacks(ind, occupied) &
+         (bb[create_piece(side, BISHOP)] | queens)) |
+        (rook_attacks(ind, occupied) &
+         (bb[create_piece(side, ROOK)] | queens));
+}
+
+/*
+ * Add a move from |from| to each square in |targets|.
+ */
+static move_t* add_moves_bb(const position_t* pos,
+        square_t from,
+        piece_t piece,
+        bitboard_t targets,
+        move_t* moves)
+{
+    for (; targets; clear_first_bit(targets)) {
+        square_t to = index_to_square(first_bit(targets));
+        moves = add_move(pos, create_move(from, to, piece, pos->board[to]),
+                moves);
+    }
+    return moves;
+}
+
+/*
+ * Add pawn moves to each square in |targets| from the square |delta|
+ * indices behind it, promoting if they reach the last rank.
+ */
+static move_t* add_pawn_moves_bb(const position_t* pos,
+        bitboard_t targets,
+        int delta,
+        move_t* moves)
+{
+    color_t side = pos->side_to_move;
+    piece_t pawn = create_piece(side, PAWN);
+    if (side == BLACK) delta = -delta;
+    for (; targets; clear_first_bit(targets)) {
+        int to_ind = first_bit(targets);
+        square_t to = index_to_square(to_ind);
+        square_t from = index_to_square(to_ind - delta);
+        if (set_mask[to_ind] & (RANK_1_BB | RANK_8_BB)) {
+            for (piece_t promoted=QUEEN; promoted > PAWN; --promoted) {
+                moves = add_move(pos, create_move_promote(from, to, pawn,
+                            pos->board[to], promoted), moves);
+            }
+        } else {
+            moves = add_move(pos, create_move(from, to, pawn,
+                        pos->board[to]), moves);
+        }
+    }
+    return moves;
+}
+
+/*
+ * Fill the provided list with all pseudolegal captures in the given position.
+ */
+static int generate_pseudo_captures(const position_t* pos, move_t* moves)
+{
+    move_t* moves_head = moves;
+    color_t side = pos->side_to_move;
+    bitboard_t occupied = pos->color_bb[WHITE] | pos->color_bb[BLACK];
+    bitboard_t them = pos->color_bb[side^1];
+    for (int i = 0; i < pos->num_pieces[side]; ++i) {
+        square_t from = pos->pieces[side][i];
+        piece_t piece = pos->board[from];
+        moves = add_moves_bb(pos, from, piece,
+                piece_attacks_bb(piece_type(piece),
+                    square_to_index(from), occupied) & them,
+                moves);
+    }
+
+    bitboard_t pawns = pos->piece_bb[create_piece(side, PAWN)];
+    moves = add_pawn_moves_bb(pos,
+            pawn_shift(pawns & ~FILE_A_BB, side, side == WHITE ? 7 : 9) &
+            them, side == WHITE ? 7 : 9, moves);
+    moves = add_pawn_moves_bb(pos,
+            pawn_shift(pawns & ~FILE_H_BB, side, side == WHITE ? 9 : 7) &
+            them, side == WHITE ? 9 : 7, moves);
+    if (pos->ep_square != EMPTY && pos->board[pos->ep_square] == EMPTY) {
+        square_t to = pos->ep_square;
+        bitboard_t capturers =
+            pawn_attacks[side^1][square_to_index(to)] & pawns;
+        for (; capturers; clear_first_bit(capturers)) {
+            square_t from = index_to_square(first_bit(capturers));
+            moves = add_move(pos, create_move_enpassant(from, to,
+                        create_piece(side, PAWN),
+                        pos->board[to + pawn_push[side^1]]), moves);
+        }
+    }
+    *moves = 0;
+    return moves-moves_head;
+}
+
+/*
+ * Generate pseudo-legal moves which are neither captures nor promotions.
+ */
+int generate_pseudo_quiet_moves(const position_t* pos, move_t* moves)
+{
+    move_t* moves_head = moves;
+    color_t side = pos->side_to_move;
+    bitboard_t occupied = pos->color_bb[WHITE] | pos->color_bb[BLACK];
+    moves = generate_castles(pos, moves);
+    for (int i = 0; i < pos->num_pieces[side]; ++i) {
+        square_t from = pos->pieces[side][i];
+        piece_t piece = pos->board[from];
+        assert(piece_color(piece) == side && piece_type(piece) != PAWN);
+        moves = add_moves_bb(pos, from, piece,
+                piece_attacks_bb(piece_type(piece),
+                    square_to_index(from), occupied) & ~occupied,
+                moves);
+    }
+
+    bitboard_t pawns = pos->piece_bb[create_piece(side, PAWN)];
+    bitboard_t last_rank = side == WHITE ? RANK_8_BB : RANK_1_BB;
+    bitboard_t third_rank = side == WHITE ? RANK_3_BB : RANK_6_BB;
+    bitboard_t single = pawn_shift(pawns, side, 8) & ~occupied;
+    bitboard_t twice = pawn_shift(single & third_rank, side, 8) & ~occupied;
+    moves = add_pawn_moves_bb(pos, single & ~last_rank, 8, moves);
+    moves = add_pawn_moves_bb(pos, twice, 16, moves);
+    *moves = 0;
+    return (moves-moves_head);
+}
+
+/*
+ * Generate all moves that evade check in the given position. This is purely
+ * legal move generation; no pseudo-legal moves.
+ */
+int generate_evasions(const position_t* pos, move_t* moves)
+{
+    assert(pos->is_check && pos->board[pos->check_square]);
+    move_t* moves_head = moves;
+    color_t side = pos->side_to_move, other_side = side^1;
+    square_t king_sq = pos->pieces[side][0];
+    int king_ind = square_to_index(king_sq);
+    int check_ind = square_to_index(pos->check_square);
+    bitboard_t us = pos->color_bb[side], them = pos->color_bb[other_side];
+    bitboard_t occupied = us | them;
+
+    // Generate king moves. The king doesn't block attacks on the squares
+    // it moves to.
+    bitboard_t king_targets = king_attacks[king_ind] & ~us;
+    for (; king_targets; clear_first_bit(king_targets)) {
+        int to_ind = first_bit(king_targets);
+        if (attackers_bb(pos, to_ind, occupied ^ set_mask[king_ind],
+                    other_side)) continue;
+        square_t to = index_to_square(to_ind);
+        moves = add_move(pos, create_move(king_sq, to,
+                    create_piece(side, KING), pos->board[to]), moves);
+    }
+    // If there are multiple checkers, only king moves are possible.
+    if (pos->is_check > 1) {
+        *moves = 0;
+        return moves-moves_head;
+    }
+
+    // Find our pinned pieces. A pinned piece can never evade check.
+    const bitboard_t* bb = pos->piece_bb;
+    bitboard_t pinned = EMPTY_BB;
+    bitboard_t snipers = (bishop_attacks(king_ind, EMPTY_BB) &
+            (bb[create_piece(other_side, BISHOP)] |
+             bb[create_piece(other_side, QUEEN)])) |
+        (rook_attacks(king_ind, EMPTY_BB) &
+            (bb[create_piece(other_side, ROOK)] |
+             bb[create_piece(other_side, QUEEN)]));
+    for (; snipers; clear_first_bit(snipers)) {
+        bitboard_t blockers = between_mask[king_ind][first_bit(snipers)] &
+            occupied;
+        if (blockers && !(blockers & (blockers-1))) pinned |= blockers & us;
+    }
+
+    // Other pieces can capture the checker or block its path to the king.
+    bitboard_t targets = set_mask[check_ind] |
+        between_mask[king_ind][check_ind];
+    for (int i = 1; i < pos->num_pieces[side]; ++i) {
+        square_t from = pos->pieces[side][i];
+        int from_ind = square_to_index(from);
+        if (pinned & set_mask[from_ind]) continue;
+        piece_t piece = pos->board[from];
+        moves = add_moves_bb(pos, from, piece,
+                piece_attacks_bb(piece_type(piece), from_ind, occupied) &
+                targets, moves);
+    }
+
+    bitboard_t pawns = bb[create_piece(side, PAWN)] & ~pinned;
+    bitboard_t third_rank = side == WHITE ? RANK_3_BB : RANK_6_BB;
+    bitboard_t single = pawn_shift(pawns, side, 8) & ~occupied;
+    bitboard_t twice = pawn_shift(single & third_rank, side, 8) & ~occupied;
+    moves = add_pawn_moves_bb(pos,
+            pawn_shift(pawns & ~FILE_A_BB, side, side == WHITE ? 7 : 9) &
+            set_mask[check_ind], side == WHITE ? 7 : 9, moves);
+    moves = add_pawn_moves_bb(pos,
+            pawn_shift(pawns & ~FILE_H_BB, side, side == WHITE ? 9 : 7) &
+            set_mask[check_ind], side == WHITE ? 9 : 7, moves);
+    moves = add_pawn_moves_bb(pos, single & targets, 8, moves);
+    moves = add_pawn_moves_bb(pos, twice & targets, 16, moves);
+
+    // An en passant capture evades check only by capturing the pawn that
+    // just moved. Make sure that taking both pawns off the board doesn't
+    // expose the king.
+    square_t ep = pos->ep_square;
+    if (ep != EMPTY && pos->check_square + pawn_push[side] == ep &&
+            pos->board[ep] == EMPTY) {
+        int ep_ind = square_to_index(ep);
+        bitboard_t capturers = pawn_attacks[other_side][ep_ind] &
+            bb[create_piece(side, PAWN)];
+        for (; capturers; clear_first_bit(capturers)) {
+            int from_ind = first_bit(capturers);
+            bitboard_t after = (occupied ^ set_mask[from_ind] ^
+                    set_mask[check_ind]) | set_mask[ep_ind];
+            if (attackers_bb(pos, king_ind, after, other_side) &
+                    ~set_mask[check_ind]) continue;
+            moves = add_move(pos, create_move_enpassant(
+                        index_to_square(from_ind), ep,
+                        create_piece(side, PAWN),
+                        pos->board[pos->check_square]), moves);
+        }
+    }
+    *moves = 0;
+    return moves-moves_head;
+}
+#endif
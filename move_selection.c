@@ -2,7 +2,6 @@
 #include "daydreamer.h"
 #include <string.h>
 
-extern search_data_t root_data;
 static const bool defer_enabled = false;
 static bool pv_cache_enabled = true;
 
@@ -39,12 +38,14 @@ static move_cache_t* get_pv_move_list(const position_t* pos);
 void init_move_selector(move_selector_t* sel,
         position_t* pos,
         generation_t gen_type,
+        search_data_t* data,
         search_node_t* search_node,
         move_t hash_move,
         float depth,
         int ply)
 {
     sel->pos = pos;
+    sel->data = data;
     if (is_check(pos) && gen_type != ROOT_GEN) {
         sel->generator = ESCAPE_GEN;
     } else {
@@ -143,8 +144,12 @@ static void generate_moves(move_selector_t* sel)
             sort_root_moves(sel);
             break;
         case PHASE_PV:
-            pv_cache = get_pv_move_list(sel->pos);
-            if (pv_cache_enabled && pv_cache->key == sel->pos->hash) {
+            // The pv cache is only used by the main search thread. Helper
+            // threads order pv nodes the same way as other nodes.
+            pv_cache = sel->data->thread_index ?
+                NULL : get_pv_move_list(sel->pos);
+            if (pv_cache_enabled && pv_cache &&
+                    pv_cache->key == sel->pos->hash) {
                 int i;
                 for (i=0; pv_cache->moves[i]; ++i) {
                     sel->moves[i] = pv_cache->moves[i];
@@ -157,17 +162,18 @@ static void generate_moves(move_selector_t* sel)
                 break;
             }
         case PHASE_NON_PV:
-            sel->moves_end = generate_pseudo_moves(sel->pos, sel->moves);
+            sel->moves_end = filter_legal_moves(sel->pos, sel->moves,
+                    generate_pseudo_moves(sel->pos, sel->moves));
             sort_moves(sel);
             break;
         case PHASE_QSEARCH_CH:
-            sel->moves_end = generate_quiescence_moves(
-                    sel->pos, sel->moves, true);
+            sel->moves_end = filter_legal_moves(sel->pos, sel->moves,
+                    generate_quiescence_moves(sel->pos, sel->moves, true));
             sort_qsearch_moves(sel);
             break;
         case PHASE_QSEARCH:
-            sel->moves_end = generate_quiescence_moves(
-                    sel->pos, sel->moves, false);
+            sel->moves_end = filter_legal_moves(sel->pos, sel->moves,
+                    generate_quiescence_moves(sel->pos, sel->moves, false));
             sort_qsearch_moves(sel);
             break;
         case PHASE_DEFERRED:
@@ -210,9 +216,7 @@ move_t select_move(move_selector_t* sel)
                 assert(sel->current_move_index <= sel->moves_end);
                 move = sel->moves[sel->current_move_index++];
                 if (!move) break;
-                if (move == sel->hash_move[0] ||
-                        !is_pseudo_move_legal(sel->pos, move)) continue;
-                check_pseudo_move_legality(sel->pos, move);
+                if (move == sel->hash_move[0]) continue;
                 sel->moves_so_far++;
                 if (!get_move_capture(move) && get_move_promote(move)!=QUEEN) {
                     sel->quiet_moves_so_far++;
@@ -229,9 +233,7 @@ move_t select_move(move_selector_t* sel)
                 if (!move) break;
                 const piece_type_t promote = get_move_promote(move);
                 if (promote && promote != QUEEN) continue;
-                if (move == sel->hash_move[0] ||
-                        !is_pseudo_move_legal(sel->pos, move)) continue;
-                check_pseudo_move_legality(sel->pos, move);
+                if (move == sel->hash_move[0]) continue;
                 sel->moves_so_far++;
                 if (!get_move_capture(move) && promote != QUEEN) {
                     sel->quiet_moves_so_far++;
@@ -289,7 +291,7 @@ static void score_moves(move_selector_t* sel)
         } else if (move == sel->killers[3]) {
             score = killer_score-3;
         } else {
-            score = (int64_t)root_data.history.history[history_index(move)];
+            score = (int64_t)sel->data->history.history[history_index(move)];
         }
         scores[i] = score;
     }
@@ -320,7 +322,7 @@ static void score_qsearch_moves(move_selector_t* sel)
             if (promote == QUEEN) tactic_bonus = 100;
             score = 6*capture - piece + 5 + tactic_bonus;
         } else {
-            score = root_data.history.history[history_index(move)];
+            score = sel->data->history.history[history_index(move)];
         }
         scores[i] = score;
     }
@@ -353,16 +355,16 @@ static int64_t score_tactical_move(position_t* pos, move_t move)
 static void sort_root_moves(move_selector_t* sel)
 {
     int i;
-    for (i=0; root_data.root_moves[i].move != NO_MOVE; ++i) {
-        sel->moves[i] = root_data.root_moves[i].move;
+    for (i=0; sel->data->root_moves[i].move != NO_MOVE; ++i) {
+        sel->moves[i] = sel->data->root_moves[i].move;
         if (sel->moves[i] == sel->hash_move[0]) {
             sel->scores[i] = INT64_MAX;
         } else if (sel->depth <= 2*PLY) {
-            sel->scores[i] = root_data.root_moves[i].qsearch_score;
+            sel->scores[i] = sel->data->root_moves[i].qsearch_score;
         } else if (options.multi_pv > 1) {
-            sel->scores[i] = root_data.root_moves[i].score;
+            sel->scores[i] = sel->data->root_moves[i].score;
         } else {
-            sel->scores[i] = (int64_t)root_data.root_moves[i].nodes;
+            sel->scores[i] = (int64_t)sel->data->root_moves[i].nodes;
         }
     }
     sel->moves_end = i;
@@ -461,7 +463,7 @@ void init_pv_cache(const int max_bytes)
  */
 void clear_pv_cache(void)
 {
-    memset(pv_cache, 0, num_buckets*sizeof(move_cache_t));
+    clear_memory(pv_cache, num_buckets*sizeof(move_cache_t));
 }
 
 /*
@@ -497,7 +499,7 @@ void add_pv_move(move_selector_t* sel, move_t move, int64_t nodes)
  */
 void commit_pv_moves(move_selector_t* sel)
 {
-    if (sel->generator == ESCAPE_GEN) return;
+    if (sel->generator == ESCAPE_GEN || sel->data->thread_index) return;
     assert(sel->pv_index == sel->moves_so_far);
     move_cache_t* pv_cache = get_pv_move_list(sel->pos);
     pv_cache->key = sel->pos->hash;
@@ -49,6 +49,7 @@ typedef struct {
     int quiet_moves_so_far;
     float depth;
     position_t* pos;
+    search_data_t* data;
     bool single_reply;
 } move_selector_t;
 
@@ -52,7 +52,7 @@ static void print_pv(search_data_t* data, int ordinal, int index)
     const int score = data->root_moves[index].score;
     // note: use time+1 to avoid divide-by-zero
     const int time = elapsed_time(&data->timer) + 1;
-    const uint64_t nodes = data->nodes_searched;
+    const uint64_t nodes = total_nodes_searched(data);
 
     if (options.verbosity) {
         char sanpv[1024];
@@ -85,9 +85,9 @@ static void print_pv(search_data_t* data, int ordinal, int index)
         copy_position(&pos, &data->root_pos);
         for (int i=0; pv[i] != NO_MOVE; ++i) do_move(&pos, pv[i], &undo);
 
-        transposition_entry_t* entry;
+        transposition_entry_t entry_copy, *entry;
         while (moves < depth) {
-            entry = get_transposition(&pos);
+            entry = get_transposition(&pos, &entry_copy);
             if (!entry || !is_move_legal(&pos, entry->move)) break;
             print_coord_move(entry->move);
             do_move(&pos, entry->move, &undo);
@@ -189,6 +189,10 @@ void print_search_stats(const search_data_t* search_data)
     int low = search_data->stats.root_fail_lows;
     printf("info string root fail highs %d fail lows %d exact results %d\n",
             high, low, depth_to_index(search_data->current_depth)-high-low);
+    if (search_data->stats.splits) {
+        printf("info string split points created %d\n",
+                search_data->stats.splits);
+    }
 }
 
 /*
@@ -4,9 +4,103 @@
 #include <stdio.h>
 #include <string.h>
 
+/*
+ * Subtree counts are cached in a table of their own, keyed on the position's
+ * hash and the remaining depth. Entries are written without locks, so the
+ * key is stored xor'd with the count and a torn write just looks like a
+ * miss.
+ */
+typedef struct {
+    uint64_t check;
+    uint64_t count;
+} perft_entry_t;
+
+static perft_entry_t* perft_table = NULL;
+static uint64_t perft_table_mask = 0;
+static size_t perft_table_bytes = 0;
+
+#define MAX_DIVIDE_THREADS  MAX_SEARCH_THREADS
+
+typedef struct {
+    position_t pos;
+    int depth;
+    int num_moves;
+    move_t* moves;
+    uint64_t* counts;
+    int* next_move;
+    mutex_t* lock;
+} divide_worker_t;
+
 static uint64_t full_search(position_t* pos, int depth);
 static uint64_t divide(position_t* pos, int depth);
 
+/*
+ * Fill |moves| with the legal moves in |pos|, terminated by NO_MOVE, and
+ * return how many there are. The moves come from the move selector rather
+ * than straight from the generator, so that perft checks the legality
+ * filtering the search relies on.
+ */
+static int perft_moves(position_t* pos, move_t* moves)
+{
+    int num_moves = 0;
+    move_selector_t selector;
+    init_move_selector(&selector, pos, PV_GEN,
+            &root_data, NULL, NO_MOVE, 0, 0);
+    for (move_t move = select_move(&selector); move != NO_MOVE;
+            move = select_move(&selector), ++num_moves) {
+        moves[num_moves] = move;
+    }
+    moves[num_moves] = NO_MOVE;
+    return num_moves;
+}
+
+/*
+ * Set the size of the perft cache. The table itself isn't allocated until
+ * a perft run needs it, since only the perft commands use it. A size of
+ * zero turns the cache off, so perft makes every move but the last.
+ */
+void init_perft_table(const size_t max_bytes)
+{
+    free(perft_table);
+    perft_table = NULL;
+    perft_table_mask = 0;
+    perft_table_bytes = max_bytes;
+}
+
+/*
+ * Forget all cached subtree counts, so timings don't depend on earlier runs.
+ * The first time, this allocates the table, as the largest power of two
+ * number of entries that fits in the configured size.
+ */
+void clear_perft_table(void)
+{
+    if (!perft_table && perft_table_bytes >= sizeof(perft_entry_t)) {
+        uint64_t num_entries = 1;
+        while (num_entries * 2 * sizeof(perft_entry_t) <= perft_table_bytes) {
+            num_entries <<= 1;
+        }
+        perft_table = malloc(num_entries * sizeof(perft_entry_t));
+        if (!perft_table) {
+            warn("Couldn't allocate the perft table\n");
+            perft_table_bytes = 0;
+            return;
+        }
+        perft_table_mask = num_entries - 1;
+    }
+    if (perft_table) {
+        clear_memory(perft_table, (perft_table_mask + 1) *
+                sizeof(perft_entry_t));
+    }
+}
+
+/*
+ * Combine a position's hash with the depth it was searched to.
+ */
+static uint64_t perft_key(const position_t* pos, int depth)
+{
+    return pos->hash ^ (depth * 0x9e3779b97f4a7c15ull);
+}
+
 /*
  * Execute a series of perft tests from a given file. The test file consists of
  * any number of test lines, and each line has the following format:
@@ -33,6 +127,7 @@ void perft_testsuite(char* filename)
         return;
     }
     int total_tests = 0, correct_tests = 0;
+    uint64_t total_nodes = 0;
     while (fgets(test, 4096, test_file)) {
         char* fen = strsep(&test, ";");
         set_position(&pos, fen);
@@ -42,23 +137,28 @@ void perft_testsuite(char* filename)
             int depth;
             uint64_t correct_answer;
             sscanf(test, "D%d %"PRIu64, &depth, &correct_answer);
+            clear_perft_table();
             start_timer(&perft_timer);
             uint64_t result = full_search(&pos, depth);
             int time = stop_timer(&perft_timer);
+            total_nodes += result;
             printf("\tDepth %d: %15"PRIu64, depth, result);
             if (result != correct_answer) {
                 failure = true;
                 printf(" expected %15"PRIu64" -- FAIL",
                         correct_answer);
             } else printf(" -- SUCCESS");
-            printf(" / %.2fs\n", time/1000.0);
+            printf(" / %.2fs / %.1f Mnps\n", time/1000.0,
+                    result / (MAX(time, 1) * 1000.0));
         } while ((test = strchr(test, ';') + 1) != (char*)1);
         ++total_tests;
         if (!failure) ++correct_tests;
         test = test_storage;
     }
-    printf("Tests completed. %d/%d tests passed in %.2fs.\n",
-            correct_tests, total_tests, elapsed_time(&perft_timer)/1000.0);
+    int total_time = elapsed_time(&perft_timer);
+    printf("Tests completed. %d/%d tests passed in %.2fs, %.1f Mnps.\n",
+            correct_tests, total_tests, total_time/1000.0,
+            total_nodes / (MAX(total_time, 1) * 1000.0));
 }
 
 /*
@@ -70,6 +170,7 @@ uint64_t perft(position_t* position, int depth, bool div)
 {
     milli_timer_t perft_timer;
     init_timer(&perft_timer);
+    clear_perft_table();
     start_timer(&perft_timer);
     uint64_t nodes;
     if (div) {
@@ -78,39 +179,76 @@ uint64_t perft(position_t* position, int depth, bool div)
         nodes = full_search(position, depth);
         printf("%"PRIu64" nodes", nodes);
     }
-    stop_timer(&perft_timer);
-    printf(", elapsed time %d ms\n", elapsed_time(&perft_timer));
+    int time = stop_timer(&perft_timer);
+    printf(", elapsed time %d ms, %.1f Mnps\n",
+            time, nodes / (MAX(time, 1) * 1000.0));
     return nodes;
 }
 
+/*
+ * Count the subtrees of root moves for divide() until none are left. Each
+ * worker takes the next unclaimed move from the shared list.
+ */
+static void* divide_worker(void* arg)
+{
+    divide_worker_t* worker = arg;
+    while (true) {
+        mutex_lock(worker->lock);
+        int index = (*worker->next_move)++;
+        mutex_unlock(worker->lock);
+        if (index >= worker->num_moves) break;
+        undo_info_t undo;
+        move_t move = worker->moves[index];
+        do_move(&worker->pos, move, &undo);
+        worker->counts[index] = full_search(&worker->pos, worker->depth-1);
+        undo_move(&worker->pos, move, &undo);
+    }
+    return NULL;
+}
+
 /*
  * Print the number of nodes descended from each legal move in the given
- * position at depth |depth|, returning the total number of nodes.
+ * position at depth |depth|, returning the total number of nodes. The root
+ * moves are shared out among as many threads as the Threads option allows,
+ * and the counts are printed in move order once they're all done.
  */
 static uint64_t divide(position_t* pos, int depth)
 {
     move_t move_list[256];
-    move_t* current_move = move_list;
-    int num_moves = 0;
-    move_selector_t selector;
-    init_move_selector(&selector, pos, PV_GEN, NULL, NO_MOVE, 0, 0);
-    for (move_t move = select_move(&selector); move != NO_MOVE;
-            move = select_move(&selector), ++num_moves) {
-        move_list[num_moves] = move;
+    uint64_t counts[256];
+    int num_moves = perft_moves(pos, move_list);
+
+    int num_threads = CLAMP(options.num_threads, 1, MAX_DIVIDE_THREADS);
+    num_threads = MAX(1, MIN(num_threads, num_moves));
+    divide_worker_t workers[MAX_DIVIDE_THREADS];
+    thread_t threads[MAX_DIVIDE_THREADS];
+    bool started[MAX_DIVIDE_THREADS];
+    int next_move = 0;
+    mutex_t lock;
+    mutex_init(&lock);
+    for (int i=0; i<num_threads; ++i) {
+        copy_position(&workers[i].pos, pos);
+        workers[i].depth = depth;
+        workers[i].num_moves = num_moves;
+        workers[i].moves = move_list;
+        workers[i].counts = counts;
+        workers[i].next_move = &next_move;
+        workers[i].lock = &lock;
+        started[i] = i && !thread_create(&threads[i], divide_worker,
+                &workers[i]);
     }
-    move_list[num_moves] = NO_MOVE;
+    divide_worker(&workers[0]);
+    for (int i=1; i<num_threads; ++i) {
+        if (started[i]) thread_join(threads[i]);
+    }
+    mutex_destroy(&lock);
 
-    uint64_t child_nodes, total_nodes=0;
+    uint64_t total_nodes = 0;
     char coord_move[7];
-    while (*current_move) {
-        undo_info_t undo;
-        do_move(pos, *current_move, &undo);
-        child_nodes = full_search(pos, depth-1);
-        total_nodes += child_nodes;
-        undo_move(pos, *current_move, &undo);
-        move_to_coord_str(*current_move, coord_move);
-        printf("%s: %8"PRIu64"\n", coord_move, child_nodes);
-        ++current_move;
+    for (int i=0; i<num_moves; ++i) {
+        total_nodes += counts[i];
+        move_to_coord_str(move_list[i], coord_move);
+        printf("%s: %8"PRIu64"\n", coord_move, counts[i]);
     }
     printf("%d moves, %"PRIu64" nodes", num_moves, total_nodes);
     return total_nodes;
@@ -118,24 +256,27 @@ static uint64_t divide(position_t* pos, int depth)
 
 /*
  * Do a full search of the position tree rooted at |pos|, to depth |depth|.
- * This does no evaluation whatsoever, it just counts nodes.
+ * This does no evaluation whatsoever, it just counts nodes. Leaves aren't
+ * visited: the number of legal moves one ply up is the number of leaves.
  */
 static uint64_t full_search(position_t* pos, int depth)
 {
     if (depth <= 0) return 1;
     move_t move_list[256];
     move_t* current_move = move_list;
-    int num_moves = 0;
-    move_selector_t selector;
-    init_move_selector(&selector, pos, PV_GEN, NULL, NO_MOVE, 0, 0);
-    for (move_t move = select_move(&selector); move != NO_MOVE;
-            move = select_move(&selector), ++num_moves) {
-        move_list[num_moves] = move;
-    }
-    move_list[num_moves] = NO_MOVE;
+    if (depth == 1) return perft_moves(pos, move_list);
 
-    if (depth == 1) return num_moves;
+    // Probe before generating, so that hits don't pay for the move list.
+    perft_entry_t* entry = NULL;
+    uint64_t key = 0;
+    if (perft_table) {
+        key = perft_key(pos, depth);
+        entry = &perft_table[key & perft_table_mask];
+        uint64_t count = entry->count;
+        if ((entry->check ^ count) == key) return count;
+    }
 
+    perft_moves(pos, move_list);
     uint64_t nodes = 0;
     while (*current_move) {
         undo_info_t undo;
@@ -144,6 +285,10 @@ static uint64_t full_search(position_t* pos, int depth)
         undo_move(pos, *current_move, &undo);
         ++current_move;
     }
+    if (entry) {
+        entry->check = key ^ nodes;
+        entry->count = nodes;
+    }
     return nodes;
 }
 
@@ -1,42 +1,212 @@
-
 #include "daydreamer.h"
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
-static position_t pgn_position;
-
 /*
- * Read the given pgn file. This is just a stub for future development.
+ * Open the given pgn file for reading with read_pgn_game.
  */
-void read_pgn(char* filename)
+bool open_pgn(pgn_reader_t* reader, char* filename)
 {
-    position_t* pos = &pgn_position;
-    set_position(pos, FEN_STARTPOS);
-    char line[4096];
-    char* ch = line;
-    FILE* pgn_file = fopen(filename, "r");
-    if (!pgn_file) {
+    reader->pending_line = false;
+    reader->line = NULL;
+    reader->line_size = 0;
+    reader->file = fopen(filename, "r");
+    if (!reader->file) {
         printf("Couldn't open pgn file %s: %s\n", filename, strerror(errno));
-        return;
-    }
-    (void)ch;
-    /*
-    while (fgets(line, 4096, pgn_file)) {
-        char *bm=NULL, *id=NULL, *token=NULL;
-        set_position(&root_data.root_pos, test);
-        while ((token = strsep(&test, "; \t"))) {
-            if (!*token) continue;
-            if (strcasestr(token, "bm")) {
-                while (!bm || !*bm) bm = strsep(&test, "; \t");
-                best_move = san_str_to_move(&root_data.root_pos, bm);
+        return false;
+    }
+    return true;
+}
+
+void close_pgn(pgn_reader_t* reader)
+{
+    if (reader->file) fclose(reader->file);
+    reader->file = NULL;
+    free(reader->line);
+    reader->line = NULL;
+    reader->line_size = 0;
+}
+
+/*
+ * Get the next line of input, including one that was read but not used by
+ * the previous game. The line buffer grows as needed, so that a token is
+ * never split across two reads. Returns false at the end of the file.
+ */
+static bool pgn_next_line(pgn_reader_t* reader)
+{
+    if (reader->pending_line) {
+        reader->pending_line = false;
+        return true;
+    }
+    size_t len = 0;
+    while (true) {
+        if (reader->line_size - len < 2) {
+            size_t size = MAX(PGN_LINE_LENGTH, 2 * reader->line_size);
+            char* line = realloc(reader->line, size);
+            if (!line) {
+                warn("Couldn't grow the pgn line buffer");
+                if (!len) return false;
+                break;
+            }
+            reader->line = line;
+            reader->line_size = size;
+        }
+        if (!fgets(reader->line + len, reader->line_size - len,
+                    reader->file)) {
+            if (!len) return false;
+            break;
+        }
+        size_t read = strlen(reader->line + len);
+        len += read;
+        if (!read || reader->line[len-1] == '\n') break;
+    }
+    reader->line[strcspn(reader->line, "\r\n")] = '\0';
+    return true;
+}
+
+/*
+ * Interpret |token| as a game termination marker, returning
+ * PGN_RESULT_UNKNOWN if it isn't one.
+ */
+static pgn_result_t pgn_parse_result(const char* token)
+{
+    if (!strncmp(token, "1-0", 3)) return PGN_WHITE_WINS;
+    if (!strncmp(token, "0-1", 3)) return PGN_BLACK_WINS;
+    if (!strncmp(token, "1/2-1/2", 7)) return PGN_DRAW;
+    return PGN_RESULT_UNKNOWN;
+}
+
+/*
+ * Handle a tag pair line, like [Result "1-0"]. Only the tags that affect
+ * the moves of the game are used: FEN sets up the starting position, and
+ * Result gives the outcome in case the movetext doesn't.
+ */
+static void pgn_parse_tag(pgn_reader_t* reader, pgn_game_t* game, char* line)
+{
+    char* name = line + 1;
+    while (isspace(*name)) ++name;
+    char* value = strchr(name, '"');
+    if (!value) return;
+    char* end = strchr(++value, '"');
+    if (end) *end = '\0';
+    if (!strncasecmp(name, "FEN", 3) && isspace(name[3])) {
+        set_position(&game->start, value);
+        if (game->start.num_pieces[WHITE] < 1 ||
+                game->start.num_pieces[BLACK] < 1 ||
+                game->start.board[game->start.pieces[WHITE][0]] != WK ||
+                game->start.board[game->start.pieces[BLACK][0]] != BK) {
+            game->truncated = true;
+        }
+        copy_position(&reader->pos, &game->start);
+    } else if (!strncasecmp(name, "Result", 6) && isspace(name[6])) {
+        game->result = pgn_parse_result(value);
+    }
+}
+
+/*
+ * Apply a single movetext token to the game. Move numbers, annotation
+ * glyphs and check marks are skipped over. Returns true if the token ends
+ * the game.
+ */
+static bool pgn_parse_token(pgn_reader_t* reader,
+        pgn_game_t* game,
+        char* token)
+{
+    if (*token == '*') return true;
+    pgn_result_t result = pgn_parse_result(token);
+    if (result != PGN_RESULT_UNKNOWN) {
+        game->result = result;
+        return true;
+    }
+    if (*token == '$') return false;
+    char* number_end = token;
+    while (isdigit(*number_end)) ++number_end;
+    if (*number_end == '.') {
+        token = number_end;
+        while (*token == '.') ++token;
+    }
+    int len = strlen(token);
+    while (len && (token[len-1] == '!' || token[len-1] == '?')) --len;
+    token[len] = '\0';
+    if (!len || game->truncated) return false;
+
+    move_t move = NO_MOVE;
+    if (game->num_moves < MAX_PGN_PLY) {
+        move = san_str_to_move(&reader->pos, token);
+    }
+    if (move == NO_MOVE) {
+        game->truncated = true;
+        return false;
+    }
+    undo_info_t undo;
+    do_move(&reader->pos, move, &undo);
+    game->moves[game->num_moves++] = move;
+    return false;
+}
+
+/*
+ * Read the next game out of |reader| into |game|. Comments and variations
+ * are skipped, so |game| holds just the main line. Returns false once there
+ * are no more games.
+ */
+bool read_pgn_game(pgn_reader_t* reader, pgn_game_t* game)
+{
+    set_position(&game->start, FEN_STARTPOS);
+    copy_position(&reader->pos, &game->start);
+    game->num_moves = 0;
+    game->result = PGN_RESULT_UNKNOWN;
+    game->truncated = false;
+
+    bool have_game = false, in_movetext = false, in_comment = false;
+    int variation_depth = 0;
+    while (pgn_next_line(reader)) {
+        char* line = reader->line;
+        if (!in_comment && !variation_depth && *line == '[') {
+            // A tag after the movetext starts the next game, so this one
+            // ended without a termination marker.
+            if (in_movetext) {
+                reader->pending_line = true;
+                return true;
             }
-            if (strcasestr(token, "id")) {
-                strsep(&test, "\"");
-                id = strsep(&test, "\"");
+            have_game = true;
+            pgn_parse_tag(reader, game, line);
+            continue;
+        }
+        if (*line == '%') continue;
+
+        for (char* ch = line; *ch; ) {
+            if (in_comment) {
+                char* end = strchr(ch, '}');
+                if (!end) break;
+                in_comment = false;
+                ch = end + 1;
+            } else if (*ch == '{') {
+                in_comment = true;
+                ++ch;
+            } else if (*ch == ';') {
+                break;
+            } else if (*ch == '(') {
+                ++variation_depth;
+                ++ch;
+            } else if (*ch == ')') {
+                if (variation_depth) --variation_depth;
+                ++ch;
+            } else if (isspace(*ch)) {
+                ++ch;
+            } else {
+                char* token = ch;
+                while (*ch && !isspace(*ch) && !strchr("{};()", *ch)) ++ch;
+                char saved = *ch;
+                *ch = '\0';
+                have_game = in_movetext = true;
+                bool game_over = !variation_depth &&
+                    pgn_parse_token(reader, game, token);
+                *ch = saved;
+                if (game_over) return true;
             }
         }
-        ch = line;
     }
-    */
+    return have_game;
 }
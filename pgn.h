@@ -0,0 +1,52 @@
+
+#ifndef PGN_H
+#define PGN_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#define MAX_PGN_PLY         1024
+// Initial size of the line buffer, which grows to fit longer lines.
+#define PGN_LINE_LENGTH     4096
+
+typedef enum {
+    PGN_RESULT_UNKNOWN,
+    PGN_WHITE_WINS,
+    PGN_BLACK_WINS,
+    PGN_DRAW
+} pgn_result_t;
+
+/*
+ * A pgn file that is being read one game at a time. A line that belongs to
+ * the next game may be read while finishing the current one, so it's kept
+ * until the next read. Lines are read whole however long they are, since
+ * some exporters put all of a game's movetext on one line. |pos| tracks the
+ * current game as it's replayed.
+ */
+typedef struct {
+    FILE* file;
+    char* line;
+    size_t line_size;
+    bool pending_line;
+    position_t pos;
+} pgn_reader_t;
+
+/*
+ * The main line of a game. If a move can't be parsed, or the game is longer
+ * than MAX_PGN_PLY, |moves| holds the moves up to that point and
+ * |truncated| is set.
+ */
+typedef struct {
+    position_t start;
+    move_t moves[MAX_PGN_PLY];
+    int num_moves;
+    pgn_result_t result;
+    bool truncated;
+} pgn_game_t;
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif // PGN_H
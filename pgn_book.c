@@ -0,0 +1,22 @@
+
+#include "daydreamer.h"
+#include <stdio.h>
+
+/*
+ * Compile a pgn file into a Polyglot opening book. Optionally takes the
+ * number of plies of each game to include, and the number of megabytes to
+ * use for aggregating moves before spilling to temporary files.
+ */
+int main(int argc, char* argv[])
+{
+    if (argc < 3 || argc > 5) {
+        printf("pgn_book takes <pgn file> <book file> "
+                "[max ply, default 40] [memory in MB, default 256]\n");
+        return -1;
+    }
+    int max_ply = argc > 3 ? atoi(argv[3]) : 40;
+    int mbytes = argc > 4 ? atoi(argv[4]) : 256;
+    init_lookup_tables();
+    return build_poly_book(argv[1], argv[2],
+            MAX(max_ply, 1), (size_t)MAX(mbytes, 1) << 20) ? 0 : 1;
+}
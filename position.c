@@ -500,9 +500,11 @@ bool is_pseudo_move_legal(position_t* pos, move_t move)
 bool is_repetition(const position_t* pos)
 {
     int max_age = MIN(pos->fifty_move_counter, pos->ply);
+    max_age = MIN(max_age, HASH_HISTORY_LENGTH);
     for (int age = 2; age < max_age; age += 2) {
         assert(pos->ply >= age);
-        if (pos->hash_history[pos->ply - age] == pos->hash) return true;
+        if (pos->hash_history[(pos->ply - age) & (HASH_HISTORY_LENGTH-1)] ==
+                pos->hash) return true;
     }
     return false;
 }
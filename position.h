@@ -6,17 +6,26 @@ extern "C" {
 #endif
 
 #define FEN_STARTPOS "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
-#define HASH_HISTORY_LENGTH  2048
+// Length of the ring of earlier position hashes kept for repetition checks.
+// It must be a power of two, and longer than the fifty move rule allows a
+// repetition to reach back.
+#define HASH_HISTORY_LENGTH  128
 
 typedef struct {
-    piece_t _board_storage[256];        // 16x16 padded board
-    piece_t* board;                     // 0x88 board in middle 128 slots
-    int piece_index[128];               // index of each piece in pieces
+    // Everything up to hash_history is the position's per-ply state, which
+    // save_position_state() copies as one block. Keep it compact.
+    uint8_t _board_storage[256];        // 16x16 padded board of piece_t
+    uint8_t* board;                     // 0x88 board in middle 128 slots
+    int8_t piece_index[128];            // index of each piece in pieces
     square_t pieces[2][32];
     square_t pawns[2][16];
     int num_pieces[2];
     int num_pawns[2];
     int piece_count[16];
+#ifdef BITBOARD_MOVEGEN
+    bitboard_t piece_bb[16];            // squares occupied by each piece
+    bitboard_t color_bb[2];             // squares occupied by each side
+#endif
     color_t side_to_move;
     move_t prev_move;
     square_t ep_square;
@@ -30,9 +39,19 @@ typedef struct {
     hashkey_t hash;
     hashkey_t pawn_hash;
     hashkey_t material_hash;
+
+    // Hashes of the positions leading up to this one, indexed by ply modulo
+    // HASH_HISTORY_LENGTH.
     hashkey_t hash_history[HASH_HISTORY_LENGTH];
 } position_t;
 
+// A copy of a position's per-ply state. It can only be restored to the
+// position it was saved from, since it includes the board pointer.
+#define POSITION_STATE_BYTES    offsetof(position_t, hash_history)
+typedef struct {
+    uint64_t data[(POSITION_STATE_BYTES + 7) / 8];
+} position_state_t;
+
 typedef struct {
     uint8_t is_check;
     square_t check_square;
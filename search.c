@@ -38,19 +38,82 @@ static const int razor_qmargin[] = { 125, 125, 300, 300 };
 static search_result_t root_search(search_data_t* search_data,
         int alpha,
         int beta);
-static int search(position_t* pos,
+static int search(search_data_t* data,
+        position_t* pos,
         search_node_t* search_node,
         int ply,
         int alpha,
         int beta,
         float depth);
-static int quiesce(position_t* pos,
+static int quiesce(search_data_t* data,
+        position_t* pos,
         search_node_t* search_node,
         int ply,
         int alpha,
         int beta,
         float depth);
-static uint64_t get_root_node_count(move_t move);
+static uint64_t get_root_node_count(search_data_t* data, move_t move);
+
+// The parts of a node's state that are needed to search each of its moves.
+typedef struct {
+    int ply;
+    float depth;
+    int beta;
+    bool full_window;
+    bool mate_threat;
+    bool single_reply;
+    int lazy_score;
+} node_t;
+
+typedef enum {
+    MOVE_SEARCHED, MOVE_PRUNED, MOVE_DEFERRED
+} move_outcome_t;
+
+// A node whose remaining moves are searched by several threads at once, in
+// split point (ybwc) mode. The thread that created it and any helpers that
+// join it take moves from the shared selector and report results under
+// |lock|. |pos| is a copy of the node's position that nobody makes moves in.
+// The creator waits on |workers_done| for the helpers to leave.
+typedef struct split_point_s {
+    mutex_t lock;
+    condition_t workers_done;
+    struct split_point_s* parent;
+    position_t pos;
+    move_selector_t* selector;
+    search_node_t* search_node;
+    node_t node;
+    int alpha;
+    move_t* searched_moves;
+    int* num_searched_moves;
+    volatile int workers;
+    volatile bool cutoff;
+    move_t cutoff_move;
+} split_point_t;
+
+static void search_split_moves(search_data_t* data,
+        split_point_t* sp,
+        position_t* pos,
+        search_node_t* search_node);
+
+// Split points that helpers may join, protected by |split_lock|. Idle
+// helpers wait on |split_available| until one is published.
+static const float min_split_depth = 4.0;
+#define MAX_SPLIT_POINTS    (8*MAX_SEARCH_THREADS)
+static mutex_t split_lock;
+static condition_t split_available;
+static split_point_t* split_points[MAX_SPLIT_POINTS];
+static int num_split_points = 0;
+static volatile int idle_helpers = 0;
+static search_data_t* smp_root = NULL;
+
+// Helper search threads. In lazy smp mode each helper searches the root
+// position independently and shares only the transposition table with the
+// main thread; in split point mode helpers wait to join split points. Either
+// way each has its own search data. |helpers| is indexed by thread index,
+// so the main thread's slot is unused.
+static search_data_t* helpers[MAX_SEARCH_THREADS];
+static thread_t helper_threads[MAX_SEARCH_THREADS];
+static int num_helpers = 0;
 
 /*
  * Zero out all search variables prior to starting a search. Leaves the
@@ -80,22 +143,25 @@ static void update_pv(move_t* dst, move_t* src, int ply, move_t move)
 }
 
 /*
- * Every time a node is expanded, increment the node counter. Every
- * POLL_INTERVAL nodes, check for user input.
+ * Every time a node is expanded, increment the node counter and handle any
+ * user input that the input thread has queued up. Every POLL_INTERVAL
+ * nodes, check the clock.
  */
 static void open_node(search_data_t* data, int ply)
 {
-    if ((++data->nodes_searched & POLL_INTERVAL) == 0) {
+    // Helper threads leave polling to the main thread, which stops them.
+    if (uci_input_pending && !data->thread_index) uci_check_for_command();
+    if ((++data->nodes_searched & POLL_INTERVAL) == 0 && !data->thread_index) {
         if (should_stop_searching(data)) data->engine_status = ENGINE_ABORTED;
-        uci_check_for_command();
         int so_far = elapsed_time(&data->timer);
         static int last_info = 0;
         if (so_far < 1000) {
             last_info = 0;
         } else if (so_far - last_info > 1000) {
             last_info = so_far;
-            uint64_t nps = data->nodes_searched/so_far*1000;
-            printf("info time %d nodes %"PRIu64, so_far, data->nodes_searched);
+            uint64_t nodes = total_nodes_searched(data);
+            uint64_t nps = nodes/so_far*1000;
+            printf("info time %d nodes %"PRIu64, so_far, nodes);
             if (options.verbosity > 1) printf(" qnodes %"PRIu64" pvnodes %"
                     PRIu64, data->qnodes_searched, data->pvnodes_searched);
             printf(" nps %"PRIu64" hashfull %d\n", nps, get_hashfull());
@@ -140,7 +206,7 @@ bool should_stop_searching(search_data_t* data)
 
     // Respect node limits, if you're into that kind of thing.
     if (data->node_limit &&
-            data->nodes_searched >= data->node_limit) return true;
+            total_nodes_searched(data) >= data->node_limit) return true;
     return false;
 }
 
@@ -198,7 +264,7 @@ static bool should_deepen(search_data_t* data)
     if (obvious_move_enabled && data->obvious_move &&
             data->depth_limit == MAX_SEARCH_PLY &&
             !data->node_limit && data->current_depth >= 7*PLY &&
-            get_root_node_count(data->obvious_move) >
+            get_root_node_count(data, data->obvious_move) >
             data->nodes_searched * 10 / 9) return false;
 
     // Allocate some extra time when the root score drops.
@@ -222,7 +288,8 @@ static bool should_deepen(search_data_t* data)
  * function provides a unified interface for calls to Scorpio bitbases and
  * Gaviota tablebases.
  */
-static bool check_eg_database(position_t* pos,
+static bool check_eg_database(search_data_t* data,
+        position_t* pos,
         float depth,
         int ply,
         int alpha,
@@ -231,7 +298,7 @@ static bool check_eg_database(position_t* pos,
 {
     // Bail out if there are too many pieces on the board or if time
     // constraints are an issue.
-    if ((root_data.time_limit && root_data.time_limit < 500) ||
+    if ((data->time_limit && data->time_limit < 500) ||
             pos->num_pieces[WHITE] + pos->num_pieces[BLACK] +
             pos->num_pawns[WHITE] + pos->num_pawns[BLACK] >
             options.max_egtb_pieces) return false;
@@ -242,7 +309,7 @@ static bool check_eg_database(position_t* pos,
         if (pos->fifty_move_counter != 0 &&
                 (ply <= 2*(depth_to_index(depth) + ply)/3)) return false;
         if (probe_scorpio_bb(pos, score, ply)) {
-            ++root_data.stats.egbb_hits;
+            ++data->stats.egbb_hits;
             return true;
         }
     }
@@ -282,13 +349,13 @@ static void store_root_data(search_data_t* data,
 /*
  * Get number of nodes searched for a root move in the last iteration.
  */
-static uint64_t get_root_node_count(move_t move)
+static uint64_t get_root_node_count(search_data_t* data, move_t move)
 {
     int i;
-    for (i=0; root_data.root_moves[i].move != move &&
-            root_data.root_moves[i].move != NO_MOVE; ++i) {}
-    assert(root_data.root_moves[i].move == move);
-    return root_data.root_moves[i].nodes;
+    for (i=0; data->root_moves[i].move != move &&
+            data->root_moves[i].move != NO_MOVE; ++i) {}
+    assert(data->root_moves[i].move == move);
+    return data->root_moves[i].nodes;
 }
 
 /*
@@ -368,7 +435,7 @@ void init_root_move(root_move_t* root_move, move_t move)
     root_move->move = move;
     undo_info_t undo;
     do_move(&root_data.root_pos, move, &undo);
-    root_move->qsearch_score = -quiesce(&root_data.root_pos,
+    root_move->qsearch_score = -quiesce(&root_data, &root_data.root_pos,
             root_data.search_stack, 1, mated_in(-1), mate_in(-1), 0.0);
     undo_move(&root_data.root_pos, move, &undo);
     root_move->pv[0] = move;
@@ -407,6 +474,153 @@ void find_obvious_move(search_data_t* data)
     }
 }
 
+/*
+ * The number of nodes searched in the current or most recent search from
+ * |data|, counting the helper threads that searched alongside it.
+ */
+uint64_t total_nodes_searched(const search_data_t* data)
+{
+    uint64_t nodes = data->nodes_searched;
+    if (data->thread_index) return nodes;
+    for (int i=1; i<=num_helpers; ++i) nodes += helpers[i]->nodes_searched;
+    return nodes;
+}
+
+/*
+ * Iterative deepening loop for a helper thread. Helpers search with a full
+ * window and no time management or output, and keep going until the main
+ * thread stops them. Odd-numbered helpers start one ply deeper than the
+ * others, so that the threads aren't all on the same iteration at once.
+ */
+static void* helper_search(void* arg)
+{
+    search_data_t* data = arg;
+    init_thread_pawn_table();
+    init_thread_material_table();
+    for (data->current_depth = (2 + (data->thread_index & 1))*PLY;
+            data->current_depth <= data->depth_limit;
+            data->current_depth += PLY) {
+        search_result_t result = root_search(data, mated_in(-1), mate_in(-1));
+        if (result == SEARCH_ABORTED) break;
+    }
+    free_pawn_table();
+    free_material_table();
+    return NULL;
+}
+
+/*
+ * Find the active split point closest to the root that hasn't failed high.
+ * The caller must hold |split_lock|.
+ */
+static split_point_t* find_split_point(void)
+{
+    split_point_t* sp = NULL;
+    for (int i=0; i<num_split_points; ++i) {
+        split_point_t* candidate = split_points[i];
+        if (candidate->cutoff) continue;
+        if (!sp || candidate->node.depth > sp->node.depth) sp = candidate;
+    }
+    return sp;
+}
+
+/*
+ * Main loop for a helper thread in split point mode. Idle helpers sleep
+ * until a split point is published, then join the active split point
+ * closest to the root, until the main thread stops them.
+ */
+static void* split_helper(void* arg)
+{
+    search_data_t* data = arg;
+    position_t pos;
+    init_thread_pawn_table();
+    init_thread_material_table();
+    atomic_add(&idle_helpers, 1);
+    while (true) {
+        split_point_t* sp = NULL;
+        mutex_lock(&split_lock);
+        while (data->engine_status != ENGINE_ABORTED &&
+                !(sp = find_split_point())) {
+            condition_wait(&split_available, &split_lock);
+        }
+        if (data->engine_status == ENGINE_ABORTED) {
+            mutex_unlock(&split_lock);
+            break;
+        }
+        mutex_lock(&sp->lock);
+        sp->workers++;
+        copy_position(&pos, &sp->pos);
+        mutex_unlock(&sp->lock);
+        mutex_unlock(&split_lock);
+
+        atomic_add(&idle_helpers, -1);
+        data->split_point = sp;
+        search_split_moves(data, sp, &pos,
+                &data->search_stack[sp->node.ply]);
+        data->split_point = NULL;
+        mutex_lock(&sp->lock);
+        if (!--sp->workers) condition_broadcast(&sp->workers_done);
+        mutex_unlock(&sp->lock);
+        atomic_add(&idle_helpers, 1);
+    }
+    atomic_add(&idle_helpers, -1);
+    free_pawn_table();
+    free_material_table();
+    return NULL;
+}
+
+/*
+ * Start options.num_threads-1 helper threads for a search of the root
+ * position and root moves in |data|.
+ */
+static void start_helpers(search_data_t* data)
+{
+    static bool split_lock_initialized = false;
+    if (!split_lock_initialized) {
+        mutex_init(&split_lock);
+        condition_init(&split_available);
+        split_lock_initialized = true;
+    }
+    smp_root = data;
+    num_helpers = 0;
+    int num_threads = MIN(options.num_threads, MAX_SEARCH_THREADS);
+    for (int i=1; i<num_threads; ++i) {
+        if (!helpers[i]) helpers[i] = malloc(sizeof(search_data_t));
+        search_data_t* helper = helpers[i];
+        if (!helper) break;
+        copy_position(&helper->root_pos, &data->root_pos);
+        init_search_data(helper);
+        memcpy(helper->root_moves, data->root_moves, sizeof(data->root_moves));
+        helper->thread_index = i;
+        helper->depth_limit = MAX_SEARCH_PLY * PLY;
+        helper->infinite = true;
+        helper->engine_status = ENGINE_THINKING;
+        void* (*helper_main)(void*) = options.smp_mode == SMP_YBWC ?
+            split_helper : helper_search;
+        if (thread_create(&helper_threads[i], helper_main, helper)) {
+            warn("Couldn't start helper search thread");
+            break;
+        }
+        ++num_helpers;
+    }
+}
+
+/*
+ * Stop all running helper threads and wait for them to finish. Their node
+ * counts stay available until the next search starts.
+ */
+static void stop_helpers(void)
+{
+    // Set the flags under |split_lock|, so that a helper can't check its
+    // status and then miss the wakeup.
+    mutex_lock(&split_lock);
+    for (int i=1; i<=num_helpers; ++i) {
+        helpers[i]->engine_status = ENGINE_ABORTED;
+    }
+    condition_broadcast(&split_available);
+    mutex_unlock(&split_lock);
+    for (int i=1; i<=num_helpers; ++i) thread_join(helper_threads[i]);
+}
+
 /*
  * Iterative deepening search of the root position. This is the external
  * function that is called by the console interface. For each depth,
@@ -454,8 +668,9 @@ void deepening_search(search_data_t* search_data, bool ponder)
         }
     }
     find_obvious_move(search_data);
+    start_helpers(search_data);
 
-    int id_score = root_data.best_score = mated_in(-1);
+    int id_score = search_data->best_score = mated_in(-1);
     int consecutive_fail_highs = 0;
     int consecutive_fail_lows = 0;
     if (!search_data->depth_limit) {
@@ -532,6 +747,7 @@ void deepening_search(search_data_t* search_data, bool ponder)
             break;
         }
     }
+    stop_helpers();
     stop_timer(&search_data->timer);
     if (search_data->engine_status == ENGINE_PONDERING) uci_wait_for_command();
 
@@ -546,6 +762,9 @@ void deepening_search(search_data_t* search_data, bool ponder)
         print_transposition_stats();
         print_pawn_stats();
         print_pv_cache_stats();
+        if (options.book_loaded && options.probe_book == &get_ctg_book_move) {
+            print_ctg_cache_stats();
+        }
         print_multipv(search_data);
     }
     char best_move[7], ponder_move[7];
@@ -569,12 +788,13 @@ static search_result_t root_search(search_data_t* search_data,
     int orig_alpha = alpha;
     search_data->best_score = alpha;
     position_t* pos = &search_data->root_pos;
-    transposition_entry_t* trans_entry = get_transposition(pos);
+    transposition_entry_t entry_copy;
+    transposition_entry_t* trans_entry = get_transposition(pos, &entry_copy);
     move_t hash_move = trans_entry ? trans_entry->move : NO_MOVE;
 
     move_selector_t selector;
     init_move_selector(&selector, pos, ROOT_GEN,
-            NULL, hash_move, search_data->current_depth, 0);
+            search_data, NULL, hash_move, search_data->current_depth, 0);
     search_data->current_move_index = 0;
     search_data->resolving_fail_high = false;
     for (move_t move = select_move(&selector); move != NO_MOVE;
@@ -601,17 +821,17 @@ static search_result_t root_search(search_data_t* search_data,
         if (search_data->current_move_index < options.multi_pv) {
             // Use full window search.
             alpha = mated_in(-1);
-            score = -search(pos, search_data->search_stack,
+            score = -search(search_data, pos, search_data->search_stack,
                     1, -beta, -alpha, search_data->current_depth+ext-PLY);
         } else {
             const bool try_lmr = lmr_enabled && ext != 0 && !is_check(pos);
             int lmr_red = try_lmr ? lmr_reduction(&selector,
                     move, false) : 0;
             if (lmr_red) {
-                score = -search(pos, search_data->search_stack,
+                score = -search(search_data, pos, search_data->search_stack,
                         1, -alpha-1, -alpha, depth-lmr_red-PLY);
             } else {
-                score = -search(pos, search_data->search_stack,
+                score = -search(search_data, pos, search_data->search_stack,
                     1, -alpha-1, -alpha, search_data->current_depth+ext-PLY);
             }
             if (score > alpha) {
@@ -623,8 +843,8 @@ static search_result_t root_search(search_data_t* search_data,
                                 coord_move);
                     }
                     search_data->resolving_fail_high = true;
-                    score = -search(pos, search_data->search_stack,
-                            1, -beta, -alpha,
+                    score = -search(search_data, pos,
+                            search_data->search_stack, 1, -beta, -alpha,
                             search_data->current_depth+ext-PLY);
                 }
             }
@@ -644,7 +864,7 @@ static search_result_t root_search(search_data_t* search_data,
             }
             update_pv(search_data->pv, search_data->search_stack->pv, 0, move);
             check_line(pos, search_data->pv);
-            print_multipv(search_data);
+            if (!search_data->thread_index) print_multipv(search_data);
         }
         search_data->resolving_fail_high = false;
     }
@@ -666,10 +886,275 @@ static search_result_t root_search(search_data_t* search_data,
     return SEARCH_EXACT;
 }
 
+/*
+ * Has the search at this node been called off, either because the whole
+ * search was stopped or because some thread failed high at a split point
+ * above it?
+ */
+static bool search_cancelled(search_data_t* data)
+{
+    if (data->engine_status == ENGINE_ABORTED) return true;
+    if (!data->split_point) return false;
+    for (split_point_t* sp = data->split_point; sp; sp = sp->parent) {
+        if (sp->cutoff) return true;
+    }
+    return smp_root->engine_status == ENGINE_ABORTED;
+}
+
+/*
+ * Should we hand the remaining moves at this node to a split point? Only
+ * in split point mode, at nodes deep enough to be worth sharing, and only
+ * if there's a helper with nothing to do.
+ */
+static bool should_split(search_data_t* data, float depth)
+{
+    return options.smp_mode == SMP_YBWC &&
+        num_helpers &&
+        idle_helpers > 0 &&
+        depth >= min_split_depth &&
+        num_split_points < MAX_SPLIT_POINTS &&
+        !search_cancelled(data);
+}
+
+/*
+ * Make |move| during the search. When built with COPY_MAKE the position
+ * state is saved in |search_node| first, so that undoing the move is a
+ * single copy instead of retracing it piece by piece.
+ */
+static void make_search_move(position_t* pos,
+        search_node_t* search_node,
+        move_t move,
+        undo_info_t* undo)
+{
+#ifdef COPY_MAKE
+    save_position_state(pos, &search_node->saved_state);
+#else
+    (void)search_node;
+#endif
+    do_move(pos, move, undo);
+}
+
+/*
+ * Take back a move made by make_search_move.
+ */
+static void unmake_search_move(position_t* pos,
+        search_node_t* search_node,
+        move_t move,
+        undo_info_t* undo)
+{
+#ifdef COPY_MAKE
+    (void)move; (void)undo;
+    restore_position_state(pos, &search_node->saved_state);
+#else
+    (void)search_node;
+    undo_move(pos, move, undo);
+#endif
+}
+
+/*
+ * Make |move| at the node described by |node| and search the resulting
+ * position, applying extensions, futility pruning and late move reductions.
+ * |move_number| is the move's place in the move ordering and |lmr_red| is
+ * the reduction the move selector suggested for it when it was selected.
+ * Pruned and deferred moves aren't searched; otherwise the move's score is
+ * stored in |score|. |selector| is only needed to defer moves, and may be
+ * NULL at split points.
+ */
+static move_outcome_t search_move(search_data_t* data,
+        position_t* pos,
+        search_node_t* search_node,
+        const node_t* node,
+        move_selector_t* selector,
+        move_t move,
+        int move_number,
+        float lmr_red,
+        int alpha,
+        int* score)
+{
+    const int ply = node->ply;
+    const float depth = node->depth;
+    const int beta = node->beta;
+    const bool full_window = node->full_window;
+    const bool mate_threat = node->mate_threat;
+    undo_info_t undo;
+    make_search_move(pos, search_node, move, &undo);
+    float ext = extend(pos, move, node->single_reply, full_window);
+    if (ext && selector && defer_move(selector, move)) {
+        unmake_search_move(pos, search_node, move, &undo);
+        return MOVE_DEFERRED;
+    }
+    if (move_number == 1) {
+        // First move, use full window search.
+        *score = -search(data, pos, search_node+1, ply+1,
+                -beta, -alpha, depth+ext-PLY);
+        unmake_search_move(pos, search_node, move, &undo);
+        return MOVE_SEARCHED;
+    }
+
+    // Futility pruning. Note: it would be nice to do extensions and
+    // futility before calling do_move, but this would require more
+    // efficient ways of identifying important moves without actually
+    // making them.
+    const bool prune_futile = futility_enabled &&
+        !full_window &&
+        !ext &&
+        !mate_threat &&
+        depth <= futility_depth_limit &&
+        !is_check(pos) &&
+        move_number >= depth_to_index(depth) + 2 &&
+        should_try_prune(selector, move);
+    if (prune_futile) {
+        // History pruning.
+        // TODO: try more stringent depth requirements
+        // TODO: try pruning based on pure move ordering, or work
+        // move order into the history count
+        // TODO: experiment with pruning inside pv
+        if (history_prune_enabled && depth <= 3.0 &&
+                is_history_prune_allowed(&data->history, move, depth)) {
+            unmake_search_move(pos, search_node, move, &undo);
+            return MOVE_PRUNED;
+        }
+        // Value pruning.
+        if (value_prune_enabled &&
+                node->lazy_score +
+                material_value(get_move_capture(move)) +
+                85 + 15*depth + 2*depth*depth <
+                beta + 2*move_number) {
+            unmake_search_move(pos, search_node, move, &undo);
+            return MOVE_PRUNED;
+        }
+    }
+    // Late move reduction (LMR), as described by Tord Romstad at
+    // http://www.glaurungchess.com/lmr.html
+    const bool try_lmr = lmr_enabled &&
+        !ext &&
+        !mate_threat &&
+        depth > lmr_depth_limit;
+    if (!try_lmr) lmr_red = 0;
+    if (lmr_red) *score = -search(data, pos, search_node+1, ply+1,
+            -alpha-1, -alpha, depth-lmr_red-PLY);
+    else *score = alpha+1;
+    if (*score > alpha) {
+        *score = -search(data, pos, search_node+1, ply+1,
+                -alpha-1, -alpha, depth+ext-PLY);
+        if (*score > alpha) *score = -search(data, pos, search_node+1,
+                ply+1, -beta, -alpha, depth+ext-PLY);
+    }
+    unmake_search_move(pos, search_node, move, &undo);
+    return MOVE_SEARCHED;
+}
+
+/*
+ * Search moves from |sp| until there are none left or one of them fails
+ * high. This is run by the split point's creator and by each helper that
+ * joins it, each with its own copy of the position and its own stack.
+ */
+static void search_split_moves(search_data_t* data,
+        split_point_t* sp,
+        position_t* pos,
+        search_node_t* search_node)
+{
+    const node_t* node = &sp->node;
+    while (true) {
+        mutex_lock(&sp->lock);
+        move_t move = sp->cutoff ? NO_MOVE : select_move(sp->selector);
+        int move_number = sp->selector->moves_so_far;
+        float lmr_red = move ?
+            lmr_reduction(sp->selector, move, node->full_window) : 0;
+        int alpha = sp->alpha;
+        mutex_unlock(&sp->lock);
+        if (!move) break;
+
+        int score;
+        move_outcome_t outcome = search_move(data, pos, search_node, node,
+                NULL, move, move_number, lmr_red, alpha, &score);
+        if (search_cancelled(data)) break;
+        if (outcome != MOVE_SEARCHED) continue;
+
+        mutex_lock(&sp->lock);
+        sp->searched_moves[(*sp->num_searched_moves)++] = move;
+        if (score > sp->alpha && !sp->cutoff) {
+            sp->alpha = score;
+            update_pv(sp->search_node->pv, (search_node+1)->pv,
+                    node->ply, move);
+            if (score >= node->beta) {
+                sp->cutoff_move = move;
+                sp->cutoff = true;
+            }
+        }
+        mutex_unlock(&sp->lock);
+    }
+}
+
+/*
+ * Search the remaining moves at a node in parallel, young brothers wait
+ * style: the first move has already been searched by the caller. Idle
+ * helpers can join until the moves run out. Updates |alpha| and the
+ * searched move list, and returns the move that failed high, if any.
+ */
+static move_t split_search(search_data_t* data,
+        position_t* pos,
+        search_node_t* search_node,
+        const node_t* node,
+        move_selector_t* selector,
+        int* alpha,
+        move_t* searched_moves,
+        int* num_searched_moves)
+{
+    split_point_t sp;
+    mutex_init(&sp.lock);
+    condition_init(&sp.workers_done);
+    sp.parent = data->split_point;
+    copy_position(&sp.pos, pos);
+    sp.selector = selector;
+    sp.search_node = search_node;
+    sp.node = *node;
+    sp.alpha = *alpha;
+    sp.searched_moves = searched_moves;
+    sp.num_searched_moves = num_searched_moves;
+    sp.workers = 0;
+    sp.cutoff = false;
+    sp.cutoff_move = NO_MOVE;
+    selector->pos = &sp.pos;
+
+    mutex_lock(&split_lock);
+    bool published = num_split_points < MAX_SPLIT_POINTS;
+    if (published) {
+        split_points[num_split_points++] = &sp;
+        condition_broadcast(&split_available);
+    }
+    mutex_unlock(&split_lock);
+    data->stats.splits++;
+
+    data->split_point = &sp;
+    search_split_moves(data, &sp, pos, search_node);
+
+    // Stop any more helpers from joining, then wait for the ones that did.
+    if (published) {
+        mutex_lock(&split_lock);
+        for (int i=0; i<num_split_points; ++i) {
+            if (split_points[i] != &sp) continue;
+            split_points[i] = split_points[--num_split_points];
+            break;
+        }
+        mutex_unlock(&split_lock);
+    }
+    mutex_lock(&sp.lock);
+    while (sp.workers) condition_wait(&sp.workers_done, &sp.lock);
+    mutex_unlock(&sp.lock);
+    data->split_point = sp.parent;
+    selector->pos = pos;
+    condition_destroy(&sp.workers_done);
+    mutex_destroy(&sp.lock);
+    *alpha = sp.alpha;
+    return sp.cutoff ? sp.cutoff_move : NO_MOVE;
+}
+
 /*
  * Search an interior, non-quiescent node.
  */
-static int search(position_t* pos,
+static int search(search_data_t* data,
+        position_t* pos,
         search_node_t* search_node,
         int ply,
         int alpha,
@@ -677,8 +1162,10 @@ static int search(position_t* pos,
         float depth)
 {
     search_node->pv[ply] = NO_MOVE;
-    if (root_data.engine_status == ENGINE_ABORTED) return 0;
-    if (depth < 0.5) return quiesce(pos, search_node, ply, alpha, beta, depth);
+    if (search_cancelled(data)) return 0;
+    if (depth < 0.5) {
+        return quiesce(data, pos, search_node, ply, alpha, beta, depth);
+    }
 
     int orig_alpha = alpha;
     alpha = MAX(alpha, mated_in(ply));
@@ -688,24 +1175,27 @@ static int search(position_t* pos,
     bool full_window = (beta-alpha > 1);
 
     // Get move from transposition table if possible.
-    transposition_entry_t* trans_entry = get_transposition(pos);
+    transposition_entry_t entry_copy;
+    transposition_entry_t* trans_entry = get_transposition(pos, &entry_copy);
     move_t hash_move = trans_entry ? trans_entry->move : NO_MOVE;
     bool mate_threat = trans_entry && trans_entry->flags & MATE_THREAT;
     if (!full_window && trans_entry &&
             is_trans_cutoff_allowed(trans_entry, depth, &alpha, &beta)) {
         search_node->pv[ply] = hash_move;
         search_node->pv[ply+1] = NO_MOVE;
-        root_data.stats.transposition_cutoffs[
-            depth_to_index(root_data.current_depth)]++;
+        data->stats.transposition_cutoffs[
+            depth_to_index(data->current_depth)]++;
         return MAX(alpha, trans_entry->score);
     }
 
     int score;
     // Check endgame bitbases/tablebases if appropriate
-    if (check_eg_database(pos, depth, ply, alpha, beta, &score)) return score;
+    if (check_eg_database(data, pos, depth, ply, alpha, beta, &score)) {
+        return score;
+    }
 
-    open_node(&root_data, ply);
-    if (full_window) root_data.pvnodes_searched++;
+    open_node(data, ply);
+    if (full_window) data->pvnodes_searched++;
     score = mated_in(-1);
     int lazy_score = simple_eval(pos);
     int depth_index = depth_to_index(depth);
@@ -723,18 +1213,18 @@ static int search(position_t* pos,
         do_nullmove(pos, &undo);
         float null_r = 2.0 + ((depth + 2.0)/4.0) +
             CLAMP(0, 1.5, (lazy_score-beta)/100.0);
-        int null_score = -search(pos, search_node+1, ply+1,
+        int null_score = -search(data, pos, search_node+1, ply+1,
                 -beta, -beta+1, depth - null_r);
         undo_nullmove(pos, &undo);
         if (is_mate_score(null_score) && null_score < 0) mate_threat = true;
         if (null_score >= beta) {
             if (verification_enabled) {
                 float rdepth = depth - null_verification_reduction;
-                if (rdepth > 0) null_score = search(pos,
+                if (rdepth > 0) null_score = search(data, pos,
                         search_node, ply, alpha, beta, rdepth);
             }
-            root_data.stats.nullmove_cutoffs[
-                depth_to_index(root_data.current_depth)]++;
+            data->stats.nullmove_cutoffs[
+                depth_to_index(data->current_depth)]++;
             if (null_score >= beta) return beta;
         }
     } else if (razoring_enabled &&
@@ -745,9 +1235,11 @@ static int search(position_t* pos,
             !is_mate_score(beta) &&
             lazy_score + razor_margin[depth_index] < beta) {
         // Razoring.
-        if (depth <= PLY) return quiesce(pos, search_node, ply, alpha, beta, 0);
+        if (depth <= PLY) {
+            return quiesce(data, pos, search_node, ply, alpha, beta, 0);
+        }
         int qbeta = beta - razor_qmargin[depth_index];
-        int qscore = quiesce(pos, search_node, ply, qbeta-1, qbeta, 0);
+        int qscore = quiesce(data, pos, search_node, ply, qbeta-1, qbeta, 0);
         if (qscore < qbeta) return qscore;
     }
 
@@ -758,7 +1250,7 @@ static int search(position_t* pos,
                 depth - iid_pv_depth_reduction :
                 MIN(depth/2, depth - iid_non_pv_depth_reduction);
         assert(iid_depth > 0);
-        search(pos, search_node, ply, alpha, beta, iid_depth);
+        search(data, pos, search_node, ply, alpha, beta, iid_depth);
         hash_move = search_node->pv[ply];
         search_node->pv[ply] = NO_MOVE;
     }
@@ -766,127 +1258,90 @@ static int search(position_t* pos,
     move_t searched_moves[256];
     move_selector_t selector;
     init_move_selector(&selector, pos, full_window ? PV_GEN : NONPV_GEN,
-            search_node, hash_move, depth, ply);
+            data, search_node, hash_move, depth, ply);
     bool single_reply = has_single_reply(&selector);
+    node_t node = { ply, depth, beta, full_window,
+        mate_threat, single_reply, lazy_score };
     int num_legal_moves = 0, num_futile_moves = 0, num_searched_moves = 0;
+    move_t cutoff_move = NO_MOVE;
+    bool split = false;
     for (move_t move = select_move(&selector); move != NO_MOVE;
             move = select_move(&selector)) {
         num_legal_moves = selector.moves_so_far;
-        int64_t nodes_before = root_data.nodes_searched;
-
-        undo_info_t undo;
-        do_move(pos, move, &undo);
-        float ext = extend(pos, move, single_reply, full_window);
-        if (ext && defer_move(&selector, move)) {
-            undo_move(pos, move, &undo);
+        int64_t nodes_before = data->nodes_searched;
+        float lmr_red = lmr_reduction(&selector, move, full_window);
+        move_outcome_t outcome = search_move(data, pos, search_node, &node,
+                &selector, move, num_legal_moves, lmr_red, alpha, &score);
+        if (search_cancelled(data)) return 0;
+        if (outcome == MOVE_DEFERRED) continue;
+        if (outcome == MOVE_PRUNED) {
+            num_futile_moves++;
+            if (full_window) add_pv_move(&selector, move, 0);
             continue;
         }
-        if (num_legal_moves == 1) {
-            // First move, use full window search.
-            score = -search(pos, search_node+1, ply+1,
-                    -beta, -alpha, depth+ext-PLY);
-        } else {
-            // Futility pruning. Note: it would be nice to do extensions and
-            // futility before calling do_move, but this would require more
-            // efficient ways of identifying important moves without actually
-            // making them.
-            const bool prune_futile = futility_enabled &&
-                !full_window &&
-                !ext &&
-                !mate_threat &&
-                depth <= futility_depth_limit &&
-                !is_check(pos) &&
-                num_legal_moves >= depth_index + 2 &&
-                should_try_prune(&selector, move);
-            if (prune_futile) {
-                // History pruning.
-                // TODO: try more stringent depth requirements
-                // TODO: try pruning based on pure move ordering, or work
-                // move order into the history count
-                // TODO: experiment with pruning inside pv
-                if (history_prune_enabled && depth <= 3.0 &&
-                        is_history_prune_allowed(&root_data.history,
-                            move, depth)) {
-                    num_futile_moves++;
-                    undo_move(pos, move, &undo);
-                    if (full_window) add_pv_move(&selector, move, 0);
-                    continue;
-                }
-                // Value pruning.
-                if (value_prune_enabled &&
-                        lazy_score +
-                        material_value(get_move_capture(move)) +
-                        85 + 15*depth + 2*depth*depth <
-                        beta + 2*num_legal_moves) {
-                    num_futile_moves++;
-                    undo_move(pos, move, &undo);
-                    if (full_window) add_pv_move(&selector, move, 0);
-                    continue;
-                }
-            }
-            // Late move reduction (LMR), as described by Tord Romstad at
-            // http://www.glaurungchess.com/lmr.html
-            const bool try_lmr = lmr_enabled &&
-                !ext &&
-                !mate_threat &&
-                depth > lmr_depth_limit;
-            float lmr_red = 0;
-            if (try_lmr) lmr_red = lmr_reduction(&selector, move, full_window);
-            if (lmr_red) score = -search(pos, search_node+1, ply+1,
-                    -alpha-1, -alpha, depth-lmr_red-PLY);
-            else score = alpha+1;
-            if (score > alpha) {
-                score = -search(pos, search_node+1, ply+1,
-                        -alpha-1, -alpha, depth+ext-PLY);
-                if (score > alpha) score = -search(pos, search_node+1, ply+1,
-                        -beta, -alpha, depth+ext-PLY);
-            }
-        }
         searched_moves[num_searched_moves++] = move;
-        undo_move(pos, move, &undo);
         if (full_window) add_pv_move(&selector, move,
-                root_data.nodes_searched - nodes_before);
+                data->nodes_searched - nodes_before);
         if (score > alpha) {
             alpha = score;
             update_pv(search_node->pv, (search_node+1)->pv, ply, move);
             check_line(pos, search_node->pv+ply);
             if (score >= beta) {
-                if (!get_move_capture(move) &&
-                        !get_move_promote(move)) {
-                    record_success(&root_data.history, move, depth);
-                    for (int i=0; i<num_searched_moves-1; ++i) {
-                        move_t m = searched_moves[i];
-                        assert(m != move);
-                        if (!get_move_capture(m) && !get_move_promote(m)) {
-                            record_failure(&root_data.history, m, depth);
-                        }
-                    }
-                    if (move != search_node->killers[0]) {
-                        search_node->killers[1] = search_node->killers[0];
-                        search_node->killers[0] = move;
-                    }
-                }
-                if (is_mate_score(score) && score > 0) {
-                    search_node->mate_killer = move;
+                cutoff_move = move;
+                break;
+            }
+        }
+
+        // Once the first move has been searched, let idle threads help
+        // with the rest.
+        if (should_split(data, depth)) {
+            split = true;
+            cutoff_move = split_search(data, pos, search_node, &node,
+                    &selector, &alpha, searched_moves, &num_searched_moves);
+            if (search_cancelled(data)) return 0;
+            num_legal_moves = selector.moves_so_far;
+            break;
+        }
+    }
+
+    if (cutoff_move) {
+        if (!get_move_capture(cutoff_move) &&
+                !get_move_promote(cutoff_move)) {
+            record_success(&data->history, cutoff_move, depth);
+            for (int i=0; i<num_searched_moves; ++i) {
+                move_t m = searched_moves[i];
+                if (m == cutoff_move) continue;
+                if (!get_move_capture(m) && !get_move_promote(m)) {
+                    record_failure(&data->history, m, depth);
                 }
-                put_transposition(pos, move, depth, beta,
-                        SCORE_LOWERBOUND, mate_threat);
-                root_data.stats.move_selection[
-                    MIN(num_legal_moves-1, HIST_BUCKETS)]++;
-                if (full_window) {
-                    root_data.stats.pv_move_selection[
-                        MIN(num_legal_moves-1, HIST_BUCKETS)]++;
-                    while ((move = select_move(&selector))) {
-                        add_pv_move(&selector, move, 0);
-                    }
-                    commit_pv_moves(&selector);
+            }
+            if (cutoff_move != search_node->killers[0]) {
+                search_node->killers[1] = search_node->killers[0];
+                search_node->killers[0] = cutoff_move;
+            }
+        }
+        if (is_mate_score(alpha) && alpha > 0) {
+            search_node->mate_killer = cutoff_move;
+        }
+        put_transposition(pos, cutoff_move, depth, beta,
+                SCORE_LOWERBOUND, mate_threat);
+        data->stats.move_selection[
+            MIN(num_legal_moves-1, HIST_BUCKETS)]++;
+        if (full_window) {
+            data->stats.pv_move_selection[
+                MIN(num_legal_moves-1, HIST_BUCKETS)]++;
+            if (!split) {
+                move_t move;
+                while ((move = select_move(&selector))) {
+                    add_pv_move(&selector, move, 0);
                 }
-                search_node->pv[ply] = NO_MOVE;
-                return beta;
+                commit_pv_moves(&selector);
             }
         }
+        search_node->pv[ply] = NO_MOVE;
+        return beta;
     }
-    if (full_window) commit_pv_moves(&selector);
+    if (full_window && !split) commit_pv_moves(&selector);
     if (!num_legal_moves) {
         // No legal moves, this is either stalemate or checkmate.
         search_node->pv[ply] = NO_MOVE;
@@ -894,8 +1349,8 @@ static int search(position_t* pos,
         return DRAW_VALUE;
     }
 
-    root_data.stats.move_selection[MIN(num_legal_moves-1, HIST_BUCKETS)]++;
-    if (full_window) root_data.stats.pv_move_selection[
+    data->stats.move_selection[MIN(num_legal_moves-1, HIST_BUCKETS)]++;
+    if (full_window) data->stats.pv_move_selection[
         MIN(num_legal_moves-1, HIST_BUCKETS)]++;
     if (alpha == orig_alpha) {
         put_transposition(pos, NO_MOVE, depth, alpha,
@@ -912,20 +1367,21 @@ static int search(position_t* pos,
  * of |search| to avoid using the static evaluator on positions that have
  * easy tactics on the board.
  */
-static int quiesce(position_t* pos,
+static int quiesce(search_data_t* data,
+        position_t* pos,
         search_node_t* search_node,
         int ply,
         int alpha,
         int beta,
         float depth)
 {
-    if (root_data.engine_status == ENGINE_ABORTED) return 0;
-    if (root_data.current_root_move &&
-            ply > root_data.current_root_move->max_ply) {
-        root_data.current_root_move->max_ply = ply;
+    if (search_cancelled(data)) return 0;
+    if (data->current_root_move &&
+            ply > data->current_root_move->max_ply) {
+        data->current_root_move->max_ply = ply;
     }
     search_node->pv[ply] = NO_MOVE;
-    open_qnode(&root_data, ply);
+    open_qnode(data, ply);
 
     alpha = MAX(alpha, mated_in(ply));
     beta = MIN(beta, mate_in(ply));
@@ -935,14 +1391,15 @@ static int quiesce(position_t* pos,
 
     // Get move from transposition table if possible.
     int orig_alpha = alpha;
-    transposition_entry_t* trans_entry = get_transposition(pos);
+    transposition_entry_t entry_copy;
+    transposition_entry_t* trans_entry = get_transposition(pos, &entry_copy);
     move_t hash_move = trans_entry ? trans_entry->move : NO_MOVE;
     if (trans_entry && 
             is_trans_cutoff_allowed(trans_entry, depth, &alpha, &beta)) {
         search_node->pv[ply] = hash_move;
         search_node->pv[ply+1] = NO_MOVE;
-        root_data.stats.transposition_cutoffs[
-            depth_to_index(root_data.current_depth)]++;
+        data->stats.transposition_cutoffs[
+            depth_to_index(data->current_depth)]++;
         return MAX(alpha, trans_entry->score);
     }
 
@@ -971,7 +1428,7 @@ static int quiesce(position_t* pos,
     generation_t gen_type = depth >= -0.5 && eval + 150 >= alpha ?
         Q_CHECK_GEN : Q_GEN;
     init_move_selector(&selector, pos, gen_type,
-            search_node, hash_move, depth, ply);
+            data, search_node, hash_move, depth, ply);
     for (move_t move = select_move(&selector); move != NO_MOVE;
             move = select_move(&selector), ++num_qmoves) {
         // TODO: prevent futility for passed pawn moves and checks
@@ -983,9 +1440,11 @@ static int quiesce(position_t* pos,
                 qfutility_margin < alpha) continue;
         if (move != hash_move && static_exchange_sign(pos, move) < 0) continue;
         undo_info_t undo;
-        do_move(pos, move, &undo);
-        int score = -quiesce(pos, search_node+1, ply+1, -beta, -alpha, depth-PLY);
-        undo_move(pos, move, &undo);
+        make_search_move(pos, search_node, move, &undo);
+        int score = -quiesce(data, pos, search_node+1, ply+1,
+                -beta, -alpha, depth-PLY);
+        unmake_search_move(pos, search_node, move, &undo);
+        if (search_cancelled(data)) return 0;
         if (score > alpha) {
             alpha = score;
             update_pv(search_node->pv, (search_node+1)->pv, ply, move);
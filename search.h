@@ -17,6 +17,10 @@ typedef struct {
     move_t pv[MAX_SEARCH_PLY+1];
     move_t killers[2];
     move_t mate_killer;
+#ifdef COPY_MAKE
+    position_state_t saved_state;       // the position before the move
+                                        // being searched from this node
+#endif
 } search_node_t;
 
 typedef enum {
@@ -30,6 +34,14 @@ typedef int score_type_t;
 #define SCORE_MASK          0x03
 #define MATE_THREAT         0x04
 
+typedef enum {
+    SMP_LAZY, SMP_YBWC
+} smp_mode_t;
+
+typedef enum {
+    REPLACE_AGED_DEPTH, REPLACE_TWO_TIER, REPLACE_EQUIDISTRIBUTED
+} replace_policy_t;
+
 typedef move_t(*book_fn)(position_t*);
 typedef struct {
     int multi_pv;
@@ -49,6 +61,12 @@ typedef struct {
     bool chess960;
     bool arena_castle;
     bool ponder;
+    int num_threads;
+    smp_mode_t smp_mode;
+    bool large_pages;
+    bool warm_start_hash;
+    bool lazy_hash_clear;
+    replace_policy_t hash_replacement;
 } options_t;
 
 extern options_t options;
@@ -65,6 +83,7 @@ typedef struct {
     int root_fail_highs;
     int root_fail_lows;
     int egbb_hits;
+    int splits;
 } search_stats_t;
 
 typedef struct {
@@ -88,6 +107,8 @@ typedef struct {
     move_t pv[MAX_SEARCH_PLY + 1];
 } root_move_t;
 
+struct split_point_s;
+
 typedef struct {
     position_t root_pos;
     search_stats_t stats;
@@ -109,6 +130,8 @@ typedef struct {
     bool resolving_fail_high;
     move_t obvious_move;
     engine_status_t engine_status;
+    int thread_index; // 0 for the main thread, which does all output
+    struct split_point_s* split_point; // innermost split being worked on
 
     // when should we stop?
     milli_timer_t timer;
@@ -123,6 +146,7 @@ typedef struct {
 
 extern search_data_t root_data;
 
+#define MAX_SEARCH_THREADS  64
 #define POLL_INTERVAL   0x3fff
 #define MATE_VALUE      32000
 #define DRAW_VALUE      0
@@ -134,7 +158,7 @@ extern search_data_t root_data;
 #define mate_in(ply)                (MATE_VALUE-(ply))
 #define mated_in(ply)               (-MATE_VALUE+(ply))
 #define should_output(s)    \
-    (elapsed_time(&((s)->timer)) > options.output_delay)
+    (!(s)->thread_index && elapsed_time(&((s)->timer)) > options.output_delay)
 
 
 #ifdef __cplusplus
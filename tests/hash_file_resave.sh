@@ -0,0 +1,23 @@
+#!/bin/sh
+# Check that a hash table loaded from a file can be saved back over that
+# same file. The loaded table is a private mapping of the file, so the save
+# must not truncate it while the mapping is still in use.
+#
+# Usage: tests/hash_file_resave.sh <engine binary>
+
+engine=${1:?usage: $0 <engine binary>}
+file=${TMPDIR:-/tmp}/dd_hash_resave.$$
+{ printf 'setoption name Hash value 4\nposition startpos\ngo depth 6\n';
+    sleep 2; printf 'savehash %s\n' "$file"; sleep 1;
+    printf 'loadhash %s\n' "$file"; sleep 1;
+    printf 'savehash %s\n' "$file"; sleep 1;
+    printf 'loadhash %s\n' "$file"; sleep 1;
+    printf 'quit\n'; } | "$engine" > "$file.out"
+status=$?
+loads=$(grep -c '^info string loaded' "$file.out")
+rm -f "$file" "$file.tmp" "$file.out"
+if [ "$status" -ne 0 ] || [ "$loads" -ne 2 ]; then
+    echo "FAIL: engine exited with $status after $loads of 2 loads"
+    exit 1
+fi
+echo "PASS"
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Check that a stop still gets through after more lines than the input
+# queue starts out with have been deferred during a search.
+#
+# Usage: tests/uci_deferred_flood.sh <engine binary>
+
+engine=${1:?usage: $0 <engine binary>}
+count=$( { printf 'uci\nposition startpos\ngo infinite\n'; sleep 1;
+        i=0; while [ $i -lt 200 ]; do
+            printf 'position startpos moves e2e4\n'; i=$((i+1)); done;
+        printf 'stop\ngo depth 4\n'; sleep 3;
+        printf 'quit\n'; } | "$engine" | grep -c '^bestmove')
+if [ "$count" -ne 2 ]; then
+    echo "FAIL: expected 2 bestmove lines, got $count"
+    exit 1
+fi
+echo "PASS"
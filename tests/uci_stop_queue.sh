@@ -0,0 +1,17 @@
+#!/bin/sh
+# Check that commands that arrive in the same write as a stop are handled
+# once the search ends, rather than dropped. The stop should end the first
+# search, and the position and go after it should start a second one, so
+# the engine must answer with two bestmove lines.
+#
+# Usage: tests/uci_stop_queue.sh <engine binary>
+
+engine=${1:?usage: $0 <engine binary>}
+count=$( { printf 'uci\nposition startpos\ngo infinite\n'; sleep 1;
+        printf 'stop\nposition startpos moves e2e4\ngo depth 4\n'; sleep 3;
+        printf 'quit\n'; } | "$engine" | grep -c '^bestmove')
+if [ "$count" -ne 2 ]; then
+    echo "FAIL: expected 2 bestmove lines, got $count"
+    exit 1
+fi
+echo "PASS"
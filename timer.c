@@ -1,6 +1,34 @@
 
 #include "daydreamer.h"
 
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+/*
+ * Read a monotonic clock, in milliseconds. A coarse clock is fine for our
+ * purposes, and where it's available it's read without a system call, so
+ * the search can check it often.
+ */
+static int64_t clock_millis(void)
+{
+#if defined(_WIN32)
+    return GetTickCount64();
+#elif defined(CLOCK_MONOTONIC_COARSE) || defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
+#endif
+}
+
 /*
  * Initialize a timer.
  */
@@ -16,7 +44,7 @@ void init_timer(milli_timer_t* timer)
 void start_timer(milli_timer_t* timer)
 {
     timer->running = true;
-    gettimeofday(&timer->tv_start, NULL);
+    timer->start_millis = clock_millis();
 }
 
 /*
@@ -25,10 +53,7 @@ void start_timer(milli_timer_t* timer)
  */
 int stop_timer(milli_timer_t* timer)
 {
-    struct timeval tv_end;
-    gettimeofday(&tv_end, NULL);
-    int elapsed_millis = (tv_end.tv_sec*1000 + tv_end.tv_usec/1000) - 
-        (timer->tv_start.tv_sec*1000 + timer->tv_start.tv_usec/1000);
+    int elapsed_millis = clock_millis() - timer->start_millis;
     timer->elapsed_millis += elapsed_millis;
     timer->running = false;
     return elapsed_millis;
@@ -41,14 +66,9 @@ int stop_timer(milli_timer_t* timer)
 int elapsed_time(milli_timer_t* timer)
 {
     if (timer->running) {
-        struct timeval tv_end;
-        gettimeofday(&tv_end, NULL);
-        int elapsed_millis = (tv_end.tv_sec*1000 + tv_end.tv_usec/1000) - 
-            (timer->tv_start.tv_sec*1000 + timer->tv_start.tv_usec/1000);
-        timer->elapsed_millis += elapsed_millis;
-        timer->tv_start.tv_sec = tv_end.tv_sec;
-        timer->tv_start.tv_usec = tv_end.tv_usec;
+        int64_t now = clock_millis();
+        timer->elapsed_millis += now - timer->start_millis;
+        timer->start_millis = now;
     }
     return timer->elapsed_millis;
 }
-
@@ -6,7 +6,7 @@ extern "C" {
 #endif
 
 typedef struct {
-    struct timeval tv_start;
+    int64_t start_millis;
     int elapsed_millis;
     bool running;
 } milli_timer_t;
@@ -1,15 +1,61 @@
 
+#include "daydreamer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "daydreamer.h"
+#ifdef HAS_MMAP
+#include <sys/mman.h>
+#endif
+
+// Entries are packed into a single 64-bit word of data, stored alongside a
+// check word that holds the data xored with the position's key. Readers and
+// writers in different threads don't take a lock, so a reader can see a
+// slot whose words come from different writes, or a word that is only half
+// written when a 32-bit build stores it in two halves. Either way the slot
+// decodes to a key that doesn't match any position, and is treated as a
+// miss. The check word also stands in for a separately stored key.
+//
+// The check word is also xored with |key_salt|. Changing the salt clears the
+// table lazily: every existing entry decodes to the wrong key, so nothing
+// stored before the change can be found again.
+//
+// The data word holds, from the low bits up: the move packed into 16 bits,
+// the score, the depth in 1/16ths of a ply, and the age and flags.
+typedef struct {
+    volatile uint64_t check;
+    volatile uint64_t data;
+} packed_entry_t;
+
+#define DEPTH_SCALE     16
+#define pack_depth(depth)   ((uint64_t)(uint16_t)((depth) * DEPTH_SCALE))
+
+// Buckets fill exactly one cache line, and the table is aligned so that
+// each probe touches a single line.
+#define bucket_size     (CACHE_LINE_BYTES / (int)sizeof(packed_entry_t))
 
-static const int bucket_size = 4;
 static size_t num_buckets;
+static size_t table_bytes;
 static int generation;
+static hashkey_t key_salt = 0;
 static const int generation_limit = 8;
 static int age_score_table[8];
-static transposition_entry_t* transposition_table = NULL;
+static packed_entry_t* transposition_table = NULL;
+static void* table_allocation = NULL;
+
+// Large tables are backed by huge pages where the platform has them, to cut
+// down on tlb misses from random probes. Explicitly reserved (hugetlbfs)
+// pages are tried first, then transparent huge pages.
+#define HUGE_PAGE_BYTES     (2<<20)
+// A table loaded from a file may also be a private mapping of the file.
+typedef enum {
+    PAGES_NORMAL, PAGES_TRANSPARENT, PAGES_HUGETLB, PAGES_FILE
+} page_mode_t;
+static const char* page_mode_names[] = {
+    "normal pages", "transparent huge pages", "reserved huge pages",
+    "a mapping of a saved table"
+};
+static page_mode_t page_mode = PAGES_NORMAL;
+static size_t allocation_bytes;
 
 static struct {
     uint64_t misses;
@@ -19,30 +65,183 @@ static struct {
     uint64_t beta;
     uint64_t exact;
     uint64_t evictions;
-    uint64_t collisions;
+    uint64_t deep_evictions;
 } hash_stats;
 
-// TODO: look into "equidistributed draft" method
+// Probe counts that survive new searches, for comparing whole runs.
+static struct {
+    uint64_t hits;
+    uint64_t misses;
+} run_stats;
+
+// How the entry to overwrite is chosen when a bucket has no entry for the
+// position being stored. See options.hash_replacement:
+//
+// REPLACE_AGED_DEPTH: replace the entry with the best combination of old
+//   age and shallow depth.
+// REPLACE_TWO_TIER: the first half of each bucket is depth-preferred, and
+//   only takes entries at least as deep as the one it drops, which is
+//   moved to the second, always-replace half. Other entries go straight
+//   to the always-replace half.
+// REPLACE_EQUIDISTRIBUTED: equidistributed draft. Stale entries go first,
+//   then the entry whose depth is most common in the current search, so
+//   that the table holds a spread of depths.
 #define entry_replace_score(entry) \
     (age_score_table[(entry)->age] - (entry)->depth)
 
+#define MAX_DRAFT   64
+#define draft_index(depth)  MIN((int)(depth), MAX_DRAFT-1)
+static uint64_t draft_counts[MAX_DRAFT];
+
 static void set_transposition_age(int age);
 
+/*
+ * Squeeze |move| into 16 bits: the from and to squares, the promotion piece
+ * and the kind of move. Everything else can be recovered from the board.
+ */
+static uint16_t pack_move(move_t move)
+{
+    if (!move) return 0;
+    uint16_t packed = (square_to_index(get_move_from(move))) |
+        ((square_to_index(get_move_to(move))) << 6);
+    if (get_move_promote(move)) {
+        packed |= (get_move_promote(move) - KNIGHT) << 12 | 1 << 14;
+    } else if (is_move_enpassant(move)) packed |= 2 << 14;
+    else if (is_move_castle(move)) packed |= 3 << 14;
+    return packed;
+}
+
+/*
+ * Rebuild the move described by |packed| in |pos|. Returns NO_MOVE if
+ * there's no piece of the side to move on the from square.
+ */
+static move_t unpack_move(const position_t* pos, uint16_t packed)
+{
+    square_t from = index_to_square(packed & 0x3f);
+    square_t to = index_to_square((packed >> 6) & 0x3f);
+    piece_t piece = pos->board[from];
+    if (from == to || piece == EMPTY ||
+            piece_color(piece) != pos->side_to_move) return NO_MOVE;
+    switch (packed >> 14) {
+        case 1: return create_move_promote(from, to, piece, pos->board[to],
+                        KNIGHT + ((packed >> 12) & 0x03));
+        case 2: return create_move_enpassant(from, to, piece,
+                        create_piece(pos->side_to_move^1, PAWN));
+        case 3: return create_move_castle(from, to, piece);
+    }
+    return create_move(from, to, piece, pos->board[to]);
+}
+
+/*
+ * Unpack the slot at |slot| into |entry|, and return the key it was stored
+ * under. The move is left in its packed form. The words are read once
+ * each, so the result is consistent even if another thread is writing the
+ * slot; if it was torn, the returned key is garbage.
+ */
+static hashkey_t read_entry(const packed_entry_t* slot,
+        transposition_entry_t* entry)
+{
+    uint64_t data = slot->data;
+    hashkey_t key = slot->check ^ data ^ key_salt;
+    entry->move = data & 0xffff;
+    entry->score = (int16_t)((data >> 16) & 0xffff);
+    entry->depth = (float)((data >> 32) & 0xffff) / DEPTH_SCALE;
+    entry->age = (data >> 48) & 0x0f;
+    entry->flags = (data >> 52) & 0x0f;
+    return key;
+}
+
+/*
+ * Pack |entry| into the slot at |slot|, under |key|. The depth is rounded
+ * down to the nearest 1/16th of a ply.
+ */
+static void write_entry(packed_entry_t* slot,
+        hashkey_t key,
+        const transposition_entry_t* entry)
+{
+    uint64_t data = pack_move(entry->move) |
+        ((uint64_t)(uint16_t)entry->score << 16) |
+        (pack_depth(entry->depth) << 32) |
+        ((uint64_t)entry->age << 48) |
+        ((uint64_t)entry->flags << 52);
+    slot->data = data;
+    slot->check = key ^ data ^ key_salt;
+}
+
+/*
+ * Allocate |bytes| of memory for the table, aligned to a cache line, using
+ * huge pages if they're enabled and available. Sets |page_mode| to the kind
+ * of memory we got.
+ */
+static packed_entry_t* alloc_table(size_t bytes)
+{
+    page_mode = PAGES_NORMAL;
+#ifdef __linux__
+    if (options.large_pages && bytes >= HUGE_PAGE_BYTES) {
+        size_t rounded = (bytes + HUGE_PAGE_BYTES - 1) &
+            ~(size_t)(HUGE_PAGE_BYTES - 1);
+#ifdef MAP_HUGETLB
+        void* mem = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            page_mode = PAGES_HUGETLB;
+            allocation_bytes = rounded;
+            table_allocation = mem;
+            return mem;
+        }
+#endif
+#ifdef MADV_HUGEPAGE
+        if (!posix_memalign(&table_allocation, HUGE_PAGE_BYTES, rounded)) {
+            if (!madvise(table_allocation, rounded, MADV_HUGEPAGE)) {
+                page_mode = PAGES_TRANSPARENT;
+            }
+            return table_allocation;
+        }
+#endif
+    }
+#endif
+    table_allocation = malloc(bytes + CACHE_LINE_BYTES);
+    if (!table_allocation) return NULL;
+    return (packed_entry_t*)(((uintptr_t)table_allocation +
+                CACHE_LINE_BYTES - 1) & ~(uintptr_t)(CACHE_LINE_BYTES - 1));
+}
+
+/*
+ * Release the table's memory.
+ */
+static void free_table(void)
+{
+    if (!table_allocation) return;
+#ifdef HAS_MMAP
+    if (page_mode == PAGES_HUGETLB || page_mode == PAGES_FILE) {
+        munmap(table_allocation, allocation_bytes);
+    } else free(table_allocation);
+#else
+    free(table_allocation);
+#endif
+    table_allocation = NULL;
+    transposition_table = NULL;
+}
+
 /*
  * Create a transposition table of the appropriate size.
  */
 void init_transposition_table(const size_t max_bytes)
 {
     assert(max_bytes >= 1024);
-    size_t size = sizeof(transposition_entry_t) * bucket_size;
+    size_t size = sizeof(packed_entry_t) * bucket_size;
     num_buckets = 1;
     while (size <= max_bytes >> 1) {
         size <<= 1;
         num_buckets <<= 1;
     }
-    if (transposition_table) free(transposition_table);
-    transposition_table = malloc(size);
+    table_bytes = max_bytes;
+    free_table();
+    transposition_table = alloc_table(size);
     assert(transposition_table);
+    if (options.verbosity) {
+        printf("info string hash table uses %s\n", page_mode_names[page_mode]);
+    }
     clear_transposition_table();
     set_transposition_age(0);
 }
@@ -52,9 +251,25 @@ void init_transposition_table(const size_t max_bytes)
  */
 void clear_transposition_table(void)
 {
-    memset(transposition_table, 0,
-            sizeof(transposition_entry_t)*bucket_size*num_buckets);
+    clear_memory((void*)transposition_table,
+            sizeof(packed_entry_t)*bucket_size*num_buckets);
+    key_salt = 0;
     memset(&hash_stats, 0, sizeof(hash_stats));
+    memset(&run_stats, 0, sizeof(run_stats));
+    memset(draft_counts, 0, sizeof(draft_counts));
+}
+
+/*
+ * Make every entry in the table invisible without touching the table's
+ * memory, by changing the key salt. The age is bumped as well, so that the
+ * old entries are the first to be replaced.
+ */
+void lazy_clear_transposition_table(void)
+{
+    hashkey_t salt;
+    do salt = random_64(); while (!salt || salt == key_salt);
+    key_salt = salt;
+    increment_transposition_age();
 }
 
 /*
@@ -72,6 +287,7 @@ static void set_transposition_age(int age)
         age_score_table[i] = age * 128;
     }
     memset(&hash_stats, 0, sizeof(hash_stats));
+    memset(draft_counts, 0, sizeof(draft_counts));
 }
 
 /*
@@ -84,22 +300,98 @@ void increment_transposition_age(void)
 }
 
 /*
- * Get the entry for the given position, if it exists.
+ * Copy the entry for the given position into |entry| and return it, or
+ * return NULL if there isn't one. Entries from a previous search are
+ * rewritten with the current age, so that they aren't the first to be
+ * replaced.
  */
-transposition_entry_t* get_transposition(position_t* pos)
+transposition_entry_t* get_transposition(position_t* pos,
+        transposition_entry_t* entry)
 {
-    transposition_entry_t* entry;
-    entry = &transposition_table[(pos->hash % num_buckets) * bucket_size];
-    for (int i=0; i<bucket_size; ++i, ++entry) {
-        if (!entry->key || entry->key != pos->hash) continue;
+    packed_entry_t* slot;
+    slot = &transposition_table[(pos->hash % num_buckets) * bucket_size];
+    for (int i=0; i<bucket_size; ++i, ++slot) {
+        hashkey_t key = read_entry(slot, entry);
+        if (!key || key != pos->hash) continue;
         hash_stats.hits++;
-        entry->age = generation;
+        run_stats.hits++;
+        entry->move = unpack_move(pos, entry->move);
+        if (entry->age != generation) {
+            entry->age = generation;
+            draft_counts[draft_index(entry->depth)]++;
+            write_entry(slot, key, entry);
+        }
         return entry;
     }
     hash_stats.misses++;
+    run_stats.misses++;
     return NULL;
 }
 
+/*
+ * Choose a slot in |bucket| for a new entry of the given depth, according
+ * to the replacement policy. The slot's current contents are unpacked into
+ * |victim|, and its key is returned in |victim_key|.
+ */
+static packed_entry_t* choose_slot(packed_entry_t* bucket,
+        hashkey_t key,
+        float depth,
+        transposition_entry_t* victim,
+        hashkey_t* victim_key)
+{
+    transposition_entry_t entry;
+    packed_entry_t* best_slot = bucket;
+    int replace_score, best_replace_score = INT_MIN;
+    const int tier_size = bucket_size / 2;
+    int num_candidates = options.hash_replacement == REPLACE_TWO_TIER ?
+        tier_size : bucket_size;
+    for (int i=0; i<num_candidates; ++i) {
+        hashkey_t slot_key = read_entry(&bucket[i], &entry);
+        if (options.hash_replacement == REPLACE_EQUIDISTRIBUTED) {
+            // Stale entries first, then the most common draft, then the
+            // shallowest.
+            if (!slot_key || entry.age != generation) {
+                replace_score = INT_MAX/2 + entry_replace_score(&entry);
+            } else {
+                replace_score = (int)MIN(draft_counts[
+                        draft_index(entry.depth)], 1<<20) * MAX_DRAFT -
+                    draft_index(entry.depth);
+            }
+        } else replace_score = entry_replace_score(&entry);
+        if (replace_score > best_replace_score) {
+            best_slot = &bucket[i];
+            best_replace_score = replace_score;
+        }
+    }
+    *victim_key = read_entry(best_slot, victim);
+    if (options.hash_replacement != REPLACE_TWO_TIER) return best_slot;
+
+    packed_entry_t* always_slot = &bucket[tier_size + (key >> 32) % tier_size];
+    if (*victim_key && victim->age == generation && victim->depth > depth) {
+        *victim_key = read_entry(always_slot, victim);
+        return always_slot;
+    }
+    // The new entry takes over the depth-preferred slot. Demote its old
+    // entry to the always-replace tier if it's from this search, in which
+    // case the always-replace entry is the one that gets dropped.
+    if (*victim_key && victim->age == generation) {
+        *victim_key = read_entry(always_slot, victim);
+        always_slot->data = best_slot->data;
+        always_slot->check = best_slot->check;
+    }
+    return best_slot;
+}
+
+/*
+ * Start loading the bucket for |key| into the cache.
+ */
+void prefetch_transposition(hashkey_t key)
+{
+    if (transposition_table) {
+        prefetch(&transposition_table[(key % num_buckets) * bucket_size]);
+    }
+}
+
 /*
  * Place a position into the table, giving the score, depth searched,
  * and recommended move.
@@ -112,51 +404,45 @@ void put_transposition(position_t* pos,
         bool mate_threat)
 {
     if (depth < 0) depth = 0;
-    transposition_entry_t* entry, *best_entry = NULL;
-    int replace_score, best_replace_score = INT_MIN;
-    entry = &transposition_table[(pos->hash % num_buckets) * bucket_size];
-    for (int i=0; i<bucket_size; ++i, ++entry) {
-        if (entry->key == pos->hash) {
-            // Update an existing entry
-            entry->age = generation;
-            entry->depth = depth;
-            entry->move = move;
-            entry->score = score;
-            entry->flags = score_type | mate_threat;
-            switch (score_type) {
-                case SCORE_LOWERBOUND: hash_stats.beta++; break;
-                case SCORE_UPPERBOUND: hash_stats.alpha++; break;
-                case SCORE_EXACT: hash_stats.exact++;
-            }
-            switch (entry->flags & SCORE_MASK) {
-                case SCORE_LOWERBOUND: hash_stats.beta--; break;
-                case SCORE_UPPERBOUND: hash_stats.alpha--; break;
-                case SCORE_EXACT: hash_stats.exact--;
-            }
-            return;
+    transposition_entry_t entry;
+    packed_entry_t* bucket, *slot = NULL;
+    bucket = &transposition_table[(pos->hash % num_buckets) * bucket_size];
+    for (int i=0; i<bucket_size; ++i) {
+        if (read_entry(&bucket[i], &entry) != pos->hash) continue;
+        // Update an existing entry
+        switch (entry.flags & SCORE_MASK) {
+            case SCORE_LOWERBOUND: hash_stats.beta--; break;
+            case SCORE_UPPERBOUND: hash_stats.alpha--; break;
+            case SCORE_EXACT: hash_stats.exact--;
         }
-        replace_score = entry_replace_score(entry);
-        if (replace_score > best_replace_score) {
-            best_entry = entry;
-            best_replace_score = replace_score;
+        if (entry.age == generation) {
+            draft_counts[draft_index(entry.depth)]--;
+        }
+        slot = &bucket[i];
+        break;
+    }
+    if (!slot) {
+        hashkey_t victim_key;
+        slot = choose_slot(bucket, pos->hash, depth, &entry, &victim_key);
+        if (!victim_key || entry.age != generation) hash_stats.occupied++;
+        else {
+            ++hash_stats.evictions;
+            if (entry.depth > depth) ++hash_stats.deep_evictions;
+            draft_counts[draft_index(entry.depth)]--;
         }
     }
-    // Replace the entry with the highest replace score.
-    assert(best_entry != NULL);
-    entry = best_entry;
-    if (!entry->key || entry->age != generation) hash_stats.occupied++;
-    else ++hash_stats.evictions;
     switch (score_type) {
         case SCORE_LOWERBOUND: hash_stats.beta++; break;
         case SCORE_UPPERBOUND: hash_stats.alpha++; break;
         case SCORE_EXACT: hash_stats.exact++;
     }
-    entry->age = generation;
-    entry->key = pos->hash;
-    entry->move = move;
-    entry->depth = depth;
-    entry->score = score;
-    entry->flags = score_type | mate_threat;
+    draft_counts[draft_index(depth)]++;
+    entry.age = generation;
+    entry.move = move;
+    entry.depth = depth;
+    entry.score = score;
+    entry.flags = score_type | mate_threat;
+    write_entry(slot, pos->hash, &entry);
 }
 
 /*
@@ -179,6 +465,140 @@ void put_transposition_line(position_t* pos,
     undo_move(pos, *moves, &undo);
 }
 
+// Saved tables start with this header, padded out to a page so that the
+// buckets can be mapped straight from the file. Tables are saved in native
+// byte order, and |byte_order| is used to reject files from other machines.
+#define SAVED_TABLE_MAGIC       "DDHASH1"
+#define SAVED_TABLE_HEADER      4096
+#define SAVED_TABLE_BYTE_ORDER  0x0102030405060708ull
+typedef struct {
+    char magic[8];
+    uint64_t byte_order;
+    uint32_t entry_bytes;
+    uint32_t entries_per_bucket;
+    uint64_t num_buckets;
+    uint32_t generation;
+    uint64_t key_salt;
+} saved_table_header_t;
+
+/*
+ * Write the whole table to |filename|, so that it can be restored later
+ * with load_transposition_table. The table is written to a temporary file
+ * that then replaces |filename|. The table may be a private mapping of
+ * |filename| itself, and truncating that file would pull the pages out from
+ * under it.
+ */
+bool save_transposition_table(const char* filename)
+{
+    char temp_name[1024];
+    if (strlen(filename) + 5 > sizeof(temp_name)) {
+        printf("info string hash file name %s is too long\n", filename);
+        return false;
+    }
+    strcpy(temp_name, filename);
+    strcat(temp_name, ".tmp");
+    FILE* file = fopen(temp_name, "wb");
+    if (!file) {
+        printf("info string couldn't create hash file %s\n", temp_name);
+        return false;
+    }
+    char header_page[SAVED_TABLE_HEADER];
+    saved_table_header_t* header = (saved_table_header_t*)header_page;
+    memset(header_page, 0, sizeof(header_page));
+    strcpy(header->magic, SAVED_TABLE_MAGIC);
+    header->byte_order = SAVED_TABLE_BYTE_ORDER;
+    header->entry_bytes = sizeof(packed_entry_t);
+    header->entries_per_bucket = bucket_size;
+    header->num_buckets = num_buckets;
+    header->generation = generation;
+    header->key_salt = key_salt;
+    size_t bytes = sizeof(packed_entry_t) * bucket_size * num_buckets;
+    bool success = fwrite(header_page, sizeof(header_page), 1, file) == 1 &&
+        fwrite((void*)transposition_table, bytes, 1, file) == 1;
+    success = !fclose(file) && success;
+#ifdef _WIN32
+    // Windows won't rename over an existing file. The table is never mapped
+    // from a file there, so the old one can go first.
+    if (success) remove(filename);
+#endif
+    success = success && !rename(temp_name, filename);
+    if (!success) {
+        printf("info string couldn't write hash file %s\n", filename);
+        remove(temp_name);
+    }
+    return success;
+}
+
+/*
+ * Replace the table with one saved by save_transposition_table. The table
+ * takes on the saved table's size. Where possible the file is mapped
+ * privately rather than read, so loading is nearly instant and pages are
+ * only read from disk as the search touches them. If the file can't be
+ * used, the current table is left alone.
+ */
+bool load_transposition_table(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        printf("info string couldn't open hash file %s\n", filename);
+        return false;
+    }
+    char header_page[SAVED_TABLE_HEADER];
+    saved_table_header_t* header = (saved_table_header_t*)header_page;
+    size_t bytes = 0;
+    bool valid = fread(header_page, sizeof(header_page), 1, file) == 1 &&
+        !strcmp(header->magic, SAVED_TABLE_MAGIC) &&
+        header->byte_order == SAVED_TABLE_BYTE_ORDER &&
+        header->entry_bytes == sizeof(packed_entry_t) &&
+        header->entries_per_bucket == (uint32_t)bucket_size &&
+        header->num_buckets &&
+        !(header->num_buckets & (header->num_buckets - 1)) &&
+        header->generation < (uint32_t)generation_limit;
+    if (valid) {
+        bytes = sizeof(packed_entry_t) * bucket_size * header->num_buckets;
+        fseek(file, 0, SEEK_END);
+        valid = (uint64_t)ftell(file) == SAVED_TABLE_HEADER + bytes;
+    }
+    if (!valid) {
+        printf("info string %s isn't a compatible hash file\n", filename);
+        fclose(file);
+        return false;
+    }
+
+    free_table();
+    num_buckets = header->num_buckets;
+    table_bytes = bytes;
+#ifdef HAS_MMAP
+    void* mem = mmap(NULL, SAVED_TABLE_HEADER + bytes,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+    if (mem != MAP_FAILED) {
+        page_mode = PAGES_FILE;
+        allocation_bytes = SAVED_TABLE_HEADER + bytes;
+        table_allocation = mem;
+        transposition_table =
+            (packed_entry_t*)((char*)mem + SAVED_TABLE_HEADER);
+    }
+#endif
+    // Start a new generation, so that none of the loaded entries belong to
+    // the current search. The draft counts then start out exact at zero,
+    // without a pass over the table that would page in a mapped file.
+    set_transposition_age((header->generation + 1) % generation_limit);
+    key_salt = header->key_salt;
+    if (!transposition_table) {
+        transposition_table = alloc_table(bytes);
+        assert(transposition_table);
+        fseek(file, SAVED_TABLE_HEADER, SEEK_SET);
+        if (fread((void*)transposition_table, bytes, 1, file) != 1) {
+            printf("info string couldn't read hash file %s\n", filename);
+            clear_transposition_table();
+        }
+    }
+    fclose(file);
+    printf("info string loaded %d MB hash table from %s, using %s\n",
+            (int)(bytes >> 20), filename, page_mode_names[page_mode]);
+    return true;
+}
+
 /*
  * Print some stats about the transposition table.
  */
@@ -189,6 +609,7 @@ void print_transposition_stats(void)
     printf(" filled %"PRIu64" (%.2f%%)", hash_stats.occupied,
             (float)hash_stats.occupied / (float)num_entries * 100.);
     printf(" evictions %"PRIu64, hash_stats.evictions);
+    printf(" (%"PRIu64" deeper)", hash_stats.deep_evictions);
     printf(" hits %"PRIu64" (%.2f%%)", hash_stats.hits,
             (float)hash_stats.hits / (hash_stats.hits+hash_stats.misses)*100.);
     printf(" misses %"PRIu64" (%.2f%%)", hash_stats.misses,
@@ -198,6 +619,14 @@ void print_transposition_stats(void)
     printf(" exact %"PRIu64"\n", hash_stats.exact);
 }
 
+/*
+ * Describe the kind of memory the table is in, for diagnostics.
+ */
+const char* get_transposition_page_mode(void)
+{
+    return page_mode_names[page_mode];
+}
+
 /*
  * How full is the hash table, in thousandths? Used for UCI info strings.
  */
@@ -206,3 +635,147 @@ int get_hashfull(void)
     return MIN(1000 * hash_stats.occupied / (num_buckets * bucket_size), 1000);
 }
 
+/*
+ * Report table hits and misses since the table was last cleared.
+ */
+void get_transposition_hit_counts(uint64_t* hits, uint64_t* misses)
+{
+    *hits = run_stats.hits;
+    *misses = run_stats.misses;
+}
+
+
+/*
+ * A position used by the table stress test, along with its legal moves.
+ */
+typedef struct {
+    position_t pos;
+    move_t moves[256];
+    int num_moves;
+} stress_position_t;
+
+typedef struct {
+    stress_position_t* positions;
+    int num_positions;
+    int iterations;
+    uint32_t seed;
+    uint64_t probes;
+    uint64_t hits;
+    uint64_t corrupt;
+} stress_thread_t;
+
+// The score and depth stored with each move in the stress test are derived
+// from the position and move, so that readers can check them.
+#define stress_score(key, move)     ((int)(((key) ^ (move)) & 0x3fff))
+#define stress_depth(key, move)     ((float)((((key) >> 16) ^ (move)) & 0x3f))
+
+static void* stress_thread(void* arg)
+{
+    stress_thread_t* work = arg;
+    uint32_t x = work->seed | 1;
+    transposition_entry_t entry;
+    for (int i=0; i<work->iterations; ++i) {
+        // xorshift, since random_32 isn't safe to share between threads.
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        stress_position_t* sp = &work->positions[x % work->num_positions];
+        hashkey_t key = sp->pos.hash;
+        if (x & 0x80000000) {
+            move_t move = sp->moves[(x >> 8) % sp->num_moves];
+            put_transposition(&sp->pos, move, stress_depth(key, move),
+                    stress_score(key, move), SCORE_EXACT, false);
+            continue;
+        }
+        work->probes++;
+        if (!get_transposition(&sp->pos, &entry)) continue;
+        work->hits++;
+        bool legal = false;
+        for (int j=0; j<sp->num_moves; ++j) {
+            if (sp->moves[j] == entry.move) legal = true;
+        }
+        if (!legal ||
+                entry.score != stress_score(key, entry.move) ||
+                entry.depth != stress_depth(key, entry.move)) {
+            work->corrupt++;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Hammer a small table from |num_threads| threads at once, each of them
+ * storing and probing random positions, and check that every probe that
+ * hits returns a move that's legal in the probed position along with the
+ * score and depth that were stored with it. The table is reallocated
+ * afterwards, so its contents are lost.
+ */
+void stress_transposition_table(int num_threads, int iterations)
+{
+    const int num_positions = 1024;
+    num_threads = CLAMP(num_threads, 1, MAX_SEARCH_THREADS);
+    stress_position_t* positions =
+        malloc(num_positions * sizeof(stress_position_t));
+    stress_thread_t* work = calloc(num_threads, sizeof(stress_thread_t));
+    thread_t* threads = malloc(num_threads * sizeof(thread_t));
+    if (!positions || !work || !threads) {
+        warn("Couldn't allocate hash stress test");
+        free(positions);
+        free(work);
+        free(threads);
+        return;
+    }
+
+    // Play random games from the starting position to get test positions.
+    position_t pos;
+    undo_info_t undo;
+    move_t moves[256];
+    for (int i=0; i<num_positions; ++i) {
+        set_position(&pos, FEN_STARTPOS);
+        int length = 1 + random_32() % 40;
+        for (int j=0; j<length; ++j) {
+            int num_moves = generate_legal_moves(&pos, moves);
+            if (!num_moves) break;
+            do_move(&pos, moves[random_32() % num_moves], &undo);
+        }
+        stress_position_t* sp = &positions[i];
+        copy_position(&sp->pos, &pos);
+        sp->num_moves = generate_legal_moves(&sp->pos, sp->moves);
+        if (!sp->num_moves) --i;
+    }
+
+    // A table with just a few buckets, so that threads collide constantly.
+    size_t saved_bytes = table_bytes;
+    init_transposition_table(16 << 10);
+    milli_timer_t timer;
+    init_timer(&timer);
+    start_timer(&timer);
+    int started = 0;
+    for (; started<num_threads; ++started) {
+        work[started].positions = positions;
+        work[started].num_positions = num_positions;
+        work[started].iterations = iterations;
+        work[started].seed = random_32();
+        if (thread_create(&threads[started], stress_thread, &work[started])) {
+            warn("Couldn't start hash stress thread");
+            break;
+        }
+    }
+    uint64_t probes = 0, hits = 0, corrupt = 0;
+    for (int i=0; i<started; ++i) {
+        thread_join(threads[i]);
+        probes += work[i].probes;
+        hits += work[i].hits;
+        corrupt += work[i].corrupt;
+    }
+    int elapsed = stop_timer(&timer);
+    init_transposition_table(saved_bytes);
+
+    printf("threads: %d\n", started);
+    printf("time: %d\n", elapsed);
+    printf("probes: %"PRIu64" hits: %"PRIu64"\n", probes, hits);
+    printf("corrupt entries: %"PRIu64"\n", corrupt);
+    free(positions);
+    free(work);
+    free(threads);
+}
@@ -5,10 +5,10 @@
 extern "C" {
 #endif
 
-// TODO: shrink this structure.
+// The contents of a transposition table slot, as returned by a probe. The
+// table itself stores entries packed into 16 bytes, see trans_table.c.
 // TODO: track mate threats and whether null moves should be attempted
 typedef struct {
-    hashkey_t key;
     move_t move;
     float depth;
     int16_t score;
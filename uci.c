@@ -16,7 +16,8 @@ static void calculate_search_time(int wtime,
         int binc,
         int movestogo);
 static void uci_handle_ext(char* command);
-static int input_available(void);
+static bool start_input_thread(void);
+static void next_input_line(char* line);
 
 /*
  * Print a helpful message that describes non-stadard uci commands supported
@@ -34,19 +35,45 @@ static void uci_print_help(void)
 "    perft <n>  \tPrint the number of positions that could be reached from the "
 "               \tcurrent position in exactly <n> moves.\n"
 "    divide <n> \tThe same as perft, but break numbers down by root move.\n"
+"               \tThe root moves are split among the search threads.\n"
 "    see <move> \tPrint the static exchange evaluation score of the given "
 "move.\n"
 "    bench <depth>\n"
 "               \tSearch a fixed set of positions to the given depth, and\n"
 "               \treport the total nodes searched and time taken.\n"
+"    smpbench <depth> [threads]\n"
+"               \tRun bench with 1, 2, 4, ... up to [threads] search threads\n"
+"               \tand report the time-to-depth speedup of each.\n"
+"    pagebench <depth> [hash MB ...]\n"
+"               \tRun bench at each hash size with and without huge pages\n"
+"               \tbacking the hash table, and report the nps of each.\n"
+"    hashpolicybench <depth> [hash MB]\n"
+"               \tRun bench under each hash replacement policy, and report\n"
+"               \tthe time to depth and hash hit rate of each.\n"
+"    evalbench [passes]\n"
+"               \tEvaluate every position one move away from the bench\n"
+"               \tpositions, and report the number of evaluations per second.\n"
+"    savehash [filename]\n"
+"               \tSave the hash table to the given file, or to the file\n"
+"               \tnamed by the Hash file option.\n"
+"    loadhash [filename]\n"
+"               \tReplace the hash table with one saved by savehash.\n"
+"    hashstress [threads] [iterations]\n"
+"               \tStore and probe a small hash table from several threads\n"
+"               \tat once and count corrupted entries. Clears the hash.\n"
 "    perftsuite <filename>\n"
 "               \tRun a suite of perft tests from a file in the format\n"
 "               \tdescribed at www.rocechess.ch/rocee.html\n"
+"               \tSubtree counts are cached in a table sized by the Perft\n"
+"               \thash option; set it to 0 to count without the cache.\n"
 "   epd <filename> <time>\n"
 "              \tRead the given epd file, and search each position for <time>\n"
 "               \tseconds.\n"
 "   book        \tPrint book information for the current position.\n"
 "               \tUses the currently loaded book.\n"
+"   polybench <filename> [probes]\n"
+"               \tTime Polyglot book probes through stdio, a memory\n"
+"               \tmapping, and a preloaded copy of the book.\n"
 "   <move>      \tMake the given move (eg e2e4) on the internal board.\n"
 "   gtb         \tLook up the current position in the Gaviota Tablebases.\n"
 "   echo <text> \tEcho the given string to standard output.\n"
@@ -61,6 +88,12 @@ static void uci_print_help(void)
 void uci_read_stream(FILE* stream)
 {
     char command[4096] = { 0 };
+    if (stream == stdin && start_input_thread()) {
+        while (true) {
+            next_input_line(command);
+            uci_handle_command(command);
+        }
+    }
     while (fgets(command, 4096, stream)) uci_handle_command(command);
 }
 
@@ -135,6 +168,43 @@ static void uci_handle_ext(char* command)
         int depth = 1;
         sscanf(command+5, " %d", &depth);
         benchmark(depth, 0);
+    } else if (!strncasecmp(command, "smpbench", 8)) {
+        int depth = 1, max_threads = num_processors();
+        sscanf(command+8, " %d %d", &depth, &max_threads);
+        smp_benchmark(depth, max_threads);
+    } else if (!strncasecmp(command, "pagebench", 9)) {
+        int hash_mbytes[16] = { 16, 256, 1024 }, num_sizes = 0;
+        char* str = command+9;
+        int depth = strtol(str, &str, 10);
+        while (num_sizes < 16) {
+            char* end;
+            int mbytes = strtol(str, &end, 10);
+            if (end == str) break;
+            hash_mbytes[num_sizes++] = CLAMP(mbytes, 1, 4096);
+            str = end;
+        }
+        if (!num_sizes) num_sizes = 3;
+        page_benchmark(MAX(depth, 1), hash_mbytes, num_sizes);
+    } else if (!strncasecmp(command, "hashpolicybench", 15)) {
+        int depth = 8, hash_mbytes = 4;
+        sscanf(command+15, " %d %d", &depth, &hash_mbytes);
+        hash_policy_benchmark(MAX(depth, 1), CLAMP(hash_mbytes, 1, 4096));
+    } else if (!strncasecmp(command, "evalbench", 9)) {
+        int passes = 10000;
+        sscanf(command+9, " %d", &passes);
+        eval_benchmark(MAX(passes, 1));
+    } else if (!strncasecmp(command, "savehash", 8) ||
+            !strncasecmp(command, "loadhash", 8)) {
+        bool save = !strncasecmp(command, "savehash", 8);
+        command += 8;
+        while (isspace(*command)) command++;
+        char* filename = *command ? command : get_option_string("Hash file");
+        if (save) save_transposition_table(filename);
+        else load_transposition_table(filename);
+    } else if (!strncasecmp(command, "hashstress", 10)) {
+        int num_threads = MAX(2, num_processors()), iterations = 1000000;
+        sscanf(command+10, " %d %d", &num_threads, &iterations);
+        stress_transposition_table(num_threads, iterations);
     } else if (!strncasecmp(command, "see", 3)) {
         command += 3;
         while (isspace(*command)) command++;
@@ -146,6 +216,14 @@ static void uci_handle_ext(char* command)
         sscanf(command+3, " %s %d", filename, &time_per_move);
         time_per_move *= 1000;
         epd_testsuite(filename, time_per_move);
+    } else if (!strncasecmp(command, "polybench", 9)) {
+        char filename[256];
+        int num_probes = 100000;
+        if (sscanf(command+9, " %255s %d", filename, &num_probes) < 1) {
+            printf("usage: polybench <filename> [probes]\n");
+            return;
+        }
+        poly_book_bench(filename, num_probes);
     } else if (!strncasecmp(command, "book", 4)) {
         if (!options.book_loaded) printf("opening book not loaded\n");
         else {
@@ -155,6 +233,9 @@ static void uci_handle_ext(char* command)
                 move_to_coord_str(book_move, move_str);
                 printf("book move %s\n", move_str);
             }
+            if (options.probe_book == &get_ctg_book_move) {
+                print_ctg_cache_stats();
+            }
         }
     } else if (!strncasecmp(command, "print", 5)) {
         print_board(pos, false);
@@ -168,7 +249,8 @@ static void uci_handle_ext(char* command)
         }
         printf("\nordered moves: ");
         move_selector_t sel;
-        init_move_selector(&sel, pos, PV_GEN, NULL, NO_MOVE, 0, 0);
+        init_move_selector(&sel, pos, PV_GEN,
+            &root_data, NULL, NO_MOVE, 0, 0);
         for (move_t move = select_move(&sel); move != NO_MOVE;
                 move = select_move(&sel)) {
             char san[8];
@@ -338,14 +420,150 @@ static void calculate_search_time(int wtime,
 }
 
 /*
- * Handle any ready uci commands. Called periodically during search.
+ * Lines read from stdin by the input thread, waiting to be handled by the
+ * main thread. The first |deferred| lines have been passed over by the
+ * search, and wait for it to finish. The queue grows rather than making the
+ * input thread wait, since the search can only empty it of lines that come
+ * after the deferred ones, such as a stop.
+ */
+#define INPUT_QUEUE_LINES   64
+static struct {
+    char (*lines)[4096];
+    int capacity, head, count, deferred;
+    bool closed;
+    bool started;
+    mutex_t lock;
+    condition_t changed;
+} input_queue;
+
+// Set whenever the input queue has lines that the search hasn't looked at,
+// so that the search can find out whether it has anything to handle by
+// reading a flag.
+volatile bool uci_input_pending = false;
+
+/*
+ * Double the size of the input queue, keeping its lines in order. The
+ * caller must hold the queue's lock. Returns false if there's no memory.
+ */
+static bool grow_input_queue(void)
+{
+    int capacity = MAX(INPUT_QUEUE_LINES, 2 * input_queue.capacity);
+    char (*lines)[4096] = malloc(capacity * sizeof(*lines));
+    if (!lines) {
+        warn("Couldn't grow the input queue");
+        return false;
+    }
+    for (int i=0; i<input_queue.count; ++i) {
+        strcpy(lines[i], input_queue.lines[
+                (input_queue.head + i) % input_queue.capacity]);
+    }
+    free(input_queue.lines);
+    input_queue.lines = lines;
+    input_queue.capacity = capacity;
+    input_queue.head = 0;
+    return true;
+}
+
+/*
+ * Body of the input thread, which blocks reading stdin and hands each line
+ * to the main thread.
+ */
+static void* read_input(void* arg)
+{
+    (void)arg;
+    char line[4096];
+    bool closed = false;
+    while (!closed) {
+        closed = !fgets(line, 4096, stdin);
+        mutex_lock(&input_queue.lock);
+        while (input_queue.count == input_queue.capacity &&
+                !grow_input_queue()) {
+            condition_wait(&input_queue.changed, &input_queue.lock);
+        }
+        if (closed) input_queue.closed = true;
+        else {
+            int index = (input_queue.head + input_queue.count++) %
+                input_queue.capacity;
+            strcpy(input_queue.lines[index], line);
+        }
+        uci_input_pending = true;
+        condition_broadcast(&input_queue.changed);
+        mutex_unlock(&input_queue.lock);
+    }
+    return NULL;
+}
+
+/*
+ * Start reading stdin on its own thread, if we aren't already. Returns
+ * false if the thread can't be started, in which case stdin has to be read
+ * directly.
+ */
+static bool start_input_thread(void)
+{
+    if (input_queue.started) return true;
+    mutex_init(&input_queue.lock);
+    condition_init(&input_queue.changed);
+    thread_t thread;
+    if (thread_create(&thread, read_input, NULL)) {
+        warn("Couldn't start input thread");
+        return false;
+    }
+    input_queue.started = true;
+    return true;
+}
+
+/*
+ * Remove the line |offset| places from the head of the input queue. Lines
+ * before it keep their order. The caller must hold the queue's lock.
+ */
+static void remove_input_line(int offset)
+{
+    for (int i=offset; i>0; --i) {
+        memcpy(input_queue.lines[(input_queue.head + i) %
+                input_queue.capacity],
+                input_queue.lines[(input_queue.head + i - 1) %
+                input_queue.capacity], sizeof(input_queue.lines[0]));
+    }
+    input_queue.head = (input_queue.head + 1) % input_queue.capacity;
+    input_queue.count--;
+    uci_input_pending = input_queue.count > input_queue.deferred;
+    condition_broadcast(&input_queue.changed);
+}
+
+/*
+ * Copy the next line of input into |line|, blocking until there is one. We
+ * exit when the input is closed and everything before that has been
+ * handled.
+ */
+static void next_input_line(char* line)
+{
+    mutex_lock(&input_queue.lock);
+    while (!input_queue.count && !input_queue.closed) {
+        condition_wait(&input_queue.changed, &input_queue.lock);
+    }
+    if (!input_queue.count && input_queue.closed) exit(0);
+    strcpy(line, input_queue.lines[input_queue.head]);
+    input_queue.deferred = 0;
+    remove_input_line(0);
+    mutex_unlock(&input_queue.lock);
+}
+
+/*
+ * Handle any ready uci commands. Called by the search whenever
+ * uci_input_pending is set. Commands that don't make sense during a search
+ * are left at the front of the queue, to be handled once the search is
+ * over, and we return as soon as the search is stopped so that anything
+ * sent after the stop is handled in order.
  */
 void uci_check_for_command()
 {
-    char input[4096];
-    if (input_available()) {
-        if (!fgets(input, 4096, stdin)) exit(0);
-        else if (!strncasecmp(input, "quit", 4)) exit(0);
+    mutex_lock(&input_queue.lock);
+    if (!input_queue.count && input_queue.closed) exit(0);
+    while (input_queue.deferred < input_queue.count &&
+            root_data.engine_status != ENGINE_ABORTED) {
+        char* input = input_queue.lines[
+            (input_queue.head + input_queue.deferred) % input_queue.capacity];
+        if (!strncasecmp(input, "quit", 4)) exit(0);
         else if (!strncasecmp(input, "stop", 4)) {
             root_data.engine_status = ENGINE_ABORTED;
         } else if (strncasecmp(input, "ponderhit", 9) == 0) {
@@ -356,8 +574,14 @@ void uci_check_for_command()
             }
         } else if (strncasecmp(input, "isready", 7) == 0) {
             printf("readyok\n");
+        } else {
+            input_queue.deferred++;
+            continue;
         }
+        remove_input_line(input_queue.deferred);
     }
+    uci_input_pending = input_queue.count > input_queue.deferred;
+    mutex_unlock(&input_queue.lock);
 }
 
 /*
@@ -367,64 +591,8 @@ void uci_check_for_command()
 void uci_wait_for_command()
 {
     char command[4096];
-    fgets(command, 4096, stdin);
+    if (!start_input_thread()) {
+        if (!fgets(command, 4096, stdin)) exit(0);
+    } else next_input_line(command);
     uci_handle_command(command);
 }
-
-/*
- * Boilerplate code to see if data is available to be read on stdin.
- * Cross-platform for unix/windows.
- *
- * Many thanks to the original author(s). I've seen minor variations on this
- * in Scorpio, Viper, Beowulf, Olithink, and others, so I don't know where
- * it's from originally. I'm just glad I didn't have to figure out how to
- * do this on windows.
- */
-#ifndef _WIN32
-// Posix version.
-int input_available(void)
-{
-    fd_set readfds;
-    struct timeval timeout;
-
-    FD_ZERO(&readfds);
-    FD_SET(fileno(stdin), &readfds);
-    // Set to timeout immediately
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
-    select(16, &readfds, 0, 0, &timeout);
-    return (FD_ISSET(fileno(stdin), &readfds));
-}
-
-#else
-
-// Windows version.
-#include <conio.h>
-int input_available(void)
-{
-    static int init=0, pipe=0;
-    static HANDLE inh;
-    DWORD dw;
-#if defined(FILE_CNT)
-    if (stdin->_cnt > 0) return stdin->_cnt;
-#endif
-    if (!init) {
-        init = 1;
-        inh = GetStdHandle(STD_INPUT_HANDLE);
-        pipe = !GetConsoleMode(inh, &dw);
-        if (!pipe) {
-            SetConsoleMode(inh,
-                    dw & ~(ENABLE_MOUSE_INPUT | ENABLE_WINDOW_INPUT));
-            FlushConsoleInputBuffer(inh);
-        }
-    }
-    if (pipe) {
-        if (!PeekNamedPipe(inh, NULL, 0, NULL, &dw, NULL)) return 1;
-        return dw;
-    } else {
-        GetNumberOfConsoleInputEvents(inh, &dw);
-        return dw <= 1 ? 0 : dw;
-    }
-}
-#endif
-
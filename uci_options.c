@@ -101,17 +101,24 @@ void print_uci_options(void)
 }
 
 /*
- * Find the uci option structure with the given name.
+ * Find the uci option structure with the given name. |name| may be followed
+ * by the rest of a setoption command. Where one option's name is a prefix
+ * of another's, like "Hash" and "Hash file", the longest match wins.
  */
 static uci_option_t* get_uci_option(const char* name)
 {
+    uci_option_t* match = NULL;
+    int match_length = 0;
     for (int i=0; i<uci_option_count; ++i) {
         int name_length = strlen(uci_options[i].name);
-        if (!strncasecmp(name, uci_options[i].name, name_length)) {
-            return &uci_options[i];
+        if (!strncasecmp(name, uci_options[i].name, name_length) &&
+                (!name[name_length] || isspace(name[name_length])) &&
+                name_length > match_length) {
+            match = &uci_options[i];
+            match_length = name_length;
         }
     }
-    return NULL;
+    return match;
 }
 
 /*
@@ -181,6 +188,35 @@ static void handle_verbosity(void* opt, char* value)
     else if (!strcasecmp(value, "high")) options.verbosity = 2;
 }
 
+/*
+ * Choose between lazy smp, where helper threads search the whole tree and
+ * share only the hash table, and split point search.
+ */
+static void handle_smp_mode(void* opt, char* value)
+{
+    if (!value) return;
+    uci_option_t* option = opt;
+    strncpy(option->value, value, sizeof(option->value) - 1);
+    options.smp_mode = SMP_LAZY;
+    if (!strcasecmp(value, "ybwc")) options.smp_mode = SMP_YBWC;
+}
+
+/*
+ * Choose how the transposition table picks an entry to overwrite.
+ */
+static void handle_hash_replacement(void* opt, char* value)
+{
+    if (!value) return;
+    uci_option_t* option = opt;
+    strncpy(option->value, value, sizeof(option->value) - 1);
+    options.hash_replacement = REPLACE_AGED_DEPTH;
+    if (!strcasecmp(value, "two tier")) {
+        options.hash_replacement = REPLACE_TWO_TIER;
+    } else if (!strcasecmp(value, "equidistributed draft")) {
+        options.hash_replacement = REPLACE_EQUIDISTRIBUTED;
+    }
+}
+
 /*
  * Initialize the transposition table.
  */
@@ -195,6 +231,35 @@ static void handle_hash(void* opt, char* value)
         sscanf(option->default_value, "%d", &mbytes);
     }
     init_transposition_table(mbytes * (1ull<<20));
+    if (options.warm_start_hash) {
+        load_transposition_table(get_option_string("Hash file"));
+    }
+}
+
+/*
+ * Seed the transposition table from the saved hash file when warm starts
+ * are turned on. The table is reloaded whenever the hash is resized.
+ */
+static void handle_warm_start(void* opt, char* value)
+{
+    default_handler(opt, value);
+    if (options.warm_start_hash) {
+        load_transposition_table(get_option_string("Hash file"));
+    }
+}
+
+/*
+ * Turn huge page backing for the transposition table on or off. The table
+ * is reallocated, unless it hasn't been created yet.
+ */
+static void handle_large_pages(void* opt, char* value)
+{
+    default_handler(opt, value);
+    uci_option_t* hash_option = get_uci_option("Hash");
+    if (!hash_option) return;
+    char hash_size[128];
+    strcpy(hash_size, hash_option->value);
+    handle_hash(hash_option, hash_size);
 }
 
 /*
@@ -213,6 +278,22 @@ static void handle_pawn_cache(void* opt, char* value)
     init_pawn_table(mbytes * (1ull<<20));
 }
 
+/*
+ * Initialize the table of cached perft counts. Zero turns it off.
+ */
+static void handle_perft_hash(void* opt, char* value)
+{
+    uci_option_t* option = opt;
+    int mbytes = 0;
+    strncpy(option->value, value, sizeof(option->value) - 1);
+    sscanf(value, "%d", &mbytes);
+    if (mbytes < option->min || mbytes > option->max) {
+        warn("Option value out of range, using default\n");
+        sscanf(option->default_value, "%d", &mbytes);
+    }
+    init_perft_table(mbytes * (1ull<<20));
+}
+
 /*
  * Initialize the pv cache.
  */
@@ -230,12 +311,30 @@ static void handle_pv_cache(void* opt, char* value)
 }
 
 /*
- * Clear the transposition table.
+ * Initialize the ctg book page cache.
+ */
+static void handle_book_cache(void* opt, char* value)
+{
+    uci_option_t* option = opt;
+    int mbytes = 0;
+    strncpy(option->value, value, sizeof(option->value) - 1);
+    sscanf(value, "%d", &mbytes);
+    if (mbytes < option->min || mbytes > option->max) {
+        warn("Option value out of range, using default\n");
+        sscanf(option->default_value, "%d", &mbytes);
+    }
+    init_ctg_cache(mbytes * (1ull<<20));
+}
+
+/*
+ * Clear the transposition table, either by wiping it or, if lazy clears
+ * are turned on, by making the current entries invisible.
  */
 static void handle_clear_hash(void* opt, char* value)
 {
     (void) opt; (void) value;
-    clear_transposition_table();
+    if (options.lazy_hash_clear) lazy_clear_transposition_table();
+    else clear_transposition_table();
 }
 
 
@@ -271,6 +370,23 @@ static void handle_scorpio_bb_path(void* opt, char* value)
     }
 }
 
+/*
+ * Set the size, in megabytes, of the largest Polyglot book that's read into
+ * memory on loading. Larger books are mapped.
+ */
+static void handle_book_preload(void* opt, char* value)
+{
+    uci_option_t* option = opt;
+    int mbytes = 0;
+    strncpy(option->value, value, sizeof(option->value) - 1);
+    sscanf(value, "%d", &mbytes);
+    if (mbytes < option->min || mbytes > option->max) {
+        warn("Option value out of range, using default\n");
+        sscanf(option->default_value, "%d", &mbytes);
+    }
+    set_poly_book_preload(mbytes << 20);
+}
+
 /*
  * Sets the path to the opening book, in Polyglot or ctg format, and
  * set the function for book probing accordingly.
@@ -297,10 +413,29 @@ static void handle_book_file(void* opt, char* value)
  */
 void init_uci_options()
 {
+    add_uci_option("Large pages", OPTION_CHECK, "true",
+            0, 0, NULL, &options.large_pages, &handle_large_pages);
     add_uci_option("Hash", OPTION_SPIN, "64",
             1, 4096, NULL, NULL, &handle_hash);
+    add_uci_option("Hash file", OPTION_STRING, "hash.dat",
+            0, 0, NULL, NULL, &default_handler);
+    add_uci_option("Warm start from hash file", OPTION_CHECK, "false",
+            0, 0, NULL, &options.warm_start_hash, &handle_warm_start);
     add_uci_option("Clear Hash", OPTION_BUTTON, "",
             0, 0, NULL, NULL, &handle_clear_hash);
+    add_uci_option("Lazy hash clear", OPTION_CHECK, "false",
+            0, 0, NULL, &options.lazy_hash_clear, &default_handler);
+    char* replace_policies[4] =
+        { "aged depth", "two tier", "equidistributed draft", NULL };
+    add_uci_option("Hash replacement", OPTION_COMBO, "aged depth",
+            0, 0, replace_policies, &options.hash_replacement,
+            &handle_hash_replacement);
+    add_uci_option("Threads", OPTION_SPIN, "1",
+            1, MAX_SEARCH_THREADS, NULL, &options.num_threads,
+            &default_handler);
+    char* smp_modes[3] = { "lazy", "ybwc", NULL };
+    add_uci_option("SMP mode", OPTION_COMBO, "lazy",
+            0, 0, smp_modes, &options.smp_mode, &handle_smp_mode);
     add_uci_option("Ponder", OPTION_CHECK, "false",
             0, 0, NULL, &options.ponder, &default_handler);
     add_uci_option("MultiPV", OPTION_SPIN, "1",
@@ -309,6 +444,10 @@ void init_uci_options()
             0, 0, NULL, &options.use_book, &default_handler);
     add_uci_option("Book file", OPTION_STRING, "book.bin",
             0, 0, NULL, NULL, &handle_book_file);
+    add_uci_option("Book cache size", OPTION_SPIN, "1",
+            0, 64, NULL, NULL, &handle_book_cache);
+    add_uci_option("Book preload size", OPTION_SPIN, "0",
+            0, 1024, NULL, NULL, &handle_book_preload);
     add_uci_option("UCI_Chess960", OPTION_CHECK, "false",
             0, 0, NULL, &options.chess960, &default_handler);
     add_uci_option("Arena-style 960 castling", OPTION_CHECK, "false",
@@ -325,6 +464,8 @@ void init_uci_options()
             1, 128, NULL, NULL, &handle_pawn_cache);
     add_uci_option("PV cache size", OPTION_SPIN, "32",
             1, 1024, NULL, NULL, &handle_pv_cache);
+    add_uci_option("Perft hash", OPTION_SPIN, "16",
+            0, 1024, NULL, NULL, &handle_perft_hash);
     add_uci_option("Output Delay", OPTION_SPIN, "2000",
             0, 1000000, NULL, &options.output_delay, &default_handler);
     char* verbosities[4] = { "low", "medium", "high", NULL };